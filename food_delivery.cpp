@@ -1,6 +1,8 @@
 #include <iostream>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <list>
 #include <stack>
 #include <map>
 #include <string>
@@ -8,18 +10,67 @@
 #include <climits>
 #include <set>
 #include <limits>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <type_traits>
+#include <cmath>
+#include <functional>
+#include <tuple>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <optional>
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define FD_COROUTINES 1
+#include <coroutine>
+#endif
+#endif
+#ifndef _WIN32
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(FD_NO_SIMD)
+#define FD_X86_KERNELS 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && !defined(FD_NO_SIMD)
+#define FD_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
+// Trivially copyable so the queue, stack and slab can move it around as plain bytes;
+// restaurant and destination are LocationTable ids, placedAt and deadline are seconds on the
+// owning system's scheduler clock.
 struct Order {
     int id;               
-    string restaurant;   
-    string destination;  
+    uint32_t restaurant;   
+    uint32_t destination;  
     double price;        
+    uint32_t placedAt;
+    uint32_t deadline;
 };
+static_assert(is_trivially_copyable<Order>::value && sizeof(Order) <= 32, "Order must stay a compact POD");
 
 
 struct Location {
     string name;
+    double latitude = 0.0;
+    double longitude = 0.0;
+    bool hasCoordinates = false;
 };
 
 
@@ -30,263 +81,5554 @@ struct Route {
 };
 
 
+// Maps location names to dense ids so the routing code can work on flat arrays. Ids below
+// baseCount can come from a mapped network snapshot (see attach); later names are interned
+// on top of it.
+class LocationTable {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    uint32_t intern(const string& name, bool& inserted) {
+        uint32_t existing = find(name);
+        if (existing != npos) {
+            inserted = false;
+            return existing;
+        }
+        uint32_t id = size();
+        Location location;
+        location.name = name;
+        entries.push_back(location);
+        ids.emplace(name, id);
+        inserted = true;
+        return id;
+    }
+
+    uint32_t find(const string& name) const {
+        if (!ids.empty()) {
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+        }
+        // Snapshot names are looked up through the file's sorted index instead of a hash map.
+        const uint32_t* first = baseSorted;
+        const uint32_t* last = baseSorted + baseCount;
+        const uint32_t* it = lower_bound(first, last, name, [&](uint32_t id, const string& key) { return this->name(id) < key; });
+        return it != last && this->name(*it) == name ? *it : npos;
+    }
+
+    void setCoordinates(uint32_t id, double latitude, double longitude) {
+        ++coordinateChanges;
+        if (id < baseCount) {
+            baseCoordinates[2 * id] = latitude;
+            baseCoordinates[2 * id + 1] = longitude;
+            return;
+        }
+        Location& entry = entries[id - baseCount];
+        entry.latitude = latitude;
+        entry.longitude = longitude;
+        entry.hasCoordinates = true;
+    }
+
+    // Returns false when the location was added without coordinates.
+    bool coordinates(uint32_t id, double& latitude, double& longitude) const {
+        if (id < baseCount) {
+            latitude = baseCoordinates[2 * id];
+            longitude = baseCoordinates[2 * id + 1];
+            return !std::isnan(latitude);
+        }
+        const Location& entry = entries[id - baseCount];
+        latitude = entry.latitude;
+        longitude = entry.longitude;
+        return entry.hasCoordinates;
+    }
+
+    bool contains(const string& name) const { return find(name) != npos; }
+    uint32_t size() const { return baseCount + static_cast<uint32_t>(entries.size()); }
+
+    // Changes whenever a coordinate may have been added or moved; spatial indexes key on it.
+    uint64_t coordinateVersion() const { return coordinateChanges + size(); }
+
+    string_view name(uint32_t id) const {
+        if (id < baseCount) return string_view(baseNames + baseNameOffsets[id], baseNameOffsets[id + 1] - baseNameOffsets[id]);
+        return entries[id - baseCount].name;
+    }
+
+    // Serves ids [0, count) straight from snapshot memory, which must outlive the table.
+    // coordinates holds latitude/longitude pairs, NaN where unknown.
+    void attach(uint32_t count, const uint32_t* nameOffsets, const char* names, const uint32_t* sortedIds, double* coordinates) {
+        entries.clear();
+        ids.clear();
+        baseCount = count;
+        baseNameOffsets = nameOffsets;
+        baseNames = names;
+        baseSorted = sortedIds;
+        baseCoordinates = coordinates;
+    }
+
+private:
+    vector<Location> entries;
+    unordered_map<string, uint32_t> ids;
+
+    uint32_t baseCount = 0;
+    const uint32_t* baseNameOffsets = nullptr;
+    const char* baseNames = nullptr;
+    const uint32_t* baseSorted = nullptr;
+    double* baseCoordinates = nullptr;
+    uint64_t coordinateChanges = 0;
+};
+
+
+// Frozen compressed-sparse-row adjacency. Each node's edges are sorted by target.
+class CsrGraph {
+public:
+    CsrGraph() = default;
+    CsrGraph(const CsrGraph&) = delete;
+    CsrGraph& operator=(const CsrGraph&) = delete;
+
+    void build(const vector<vector<pair<uint32_t, int>>>& adjacency) {
+        uint32_t n = static_cast<uint32_t>(adjacency.size());
+        ownedOffsets.assign(n + 1, 0);
+        for (uint32_t u = 0; u < n; ++u) {
+            ownedOffsets[u + 1] = ownedOffsets[u] + static_cast<uint32_t>(adjacency[u].size());
+        }
+        ownedTargets.resize(ownedOffsets[n]);
+        ownedWeights.resize(ownedOffsets[n]);
+        for (uint32_t u = 0; u < n; ++u) {
+            vector<pair<uint32_t, int>> edges = adjacency[u];
+            sort(edges.begin(), edges.end());
+            uint32_t e = ownedOffsets[u];
+            for (const auto& edge : edges) {
+                ownedTargets[e] = edge.first;
+                ownedWeights[e] = edge.second;
+                ++e;
+            }
+        }
+        nodes = n;
+        edges = ownedOffsets[n];
+        offsets = ownedOffsets.data();
+        targets = ownedTargets.data();
+        weights = ownedWeights.data();
+    }
+
+    // Uses arrays owned elsewhere (a mapped snapshot) without copying them. Each node's
+    // targets must already be sorted.
+    void adopt(uint32_t nodeCount, const uint32_t* offsetArray, const uint32_t* targetArray, const int* weightArray) {
+        ownedOffsets.clear();
+        ownedTargets.clear();
+        ownedWeights.clear();
+        nodes = nodeCount;
+        edges = offsetArray[nodeCount];
+        offsets = offsetArray;
+        targets = targetArray;
+        weights = weightArray;
+    }
+
+    uint32_t nodeCount() const { return nodes; }
+    uint32_t edgeCount() const { return edges; }
+    uint32_t edgeBegin(uint32_t u) const { return offsets[u]; }
+    uint32_t edgeEnd(uint32_t u) const { return offsets[u + 1]; }
+    uint32_t target(uint32_t e) const { return targets[e]; }
+    int weight(uint32_t e) const { return weights[e]; }
+
+    // Returns INT_MAX when there is no direct edge u -> v.
+    int edgeWeight(uint32_t u, uint32_t v) const {
+        uint32_t e = edgeIndex(u, v);
+        return e == UINT32_MAX ? INT_MAX : weights[e];
+    }
+
+    // Returns UINT32_MAX when there is no direct edge u -> v.
+    uint32_t edgeIndex(uint32_t u, uint32_t v) const {
+        const uint32_t* first = targets + offsets[u];
+        const uint32_t* last = targets + offsets[u + 1];
+        const uint32_t* it = lower_bound(first, last, v);
+        if (it == last || *it != v) return UINT32_MAX;
+        return static_cast<uint32_t>(it - targets);
+    }
+
+private:
+    uint32_t nodes = 0;
+    uint32_t edges = 0;
+    const uint32_t* offsets = nullptr;
+    const uint32_t* targets = nullptr;
+    const int* weights = nullptr;
+
+    vector<uint32_t> ownedOffsets;
+    vector<uint32_t> ownedTargets;
+    vector<int> ownedWeights;
+};
+
+
+// Time-of-day slowdowns for edges. A profile is 96 quarter-hour factors in 1/32 steps (32 is
+// free flow), interpolated linearly between slot starts and wrapping at midnight. Profiles are
+// interned, so edges sharing a pattern share its 96 bytes, and each CSR edge carries a 4-byte
+// profile index with 0 for free flow: 500k edges take 2 MB plus their distinct profiles.
+class TravelProfiles {
+public:
+    static constexpr uint32_t slotsPerDay = 96;
+    static constexpr uint32_t secondsPerSlot = 24 * 3600 / slotsPerDay;
+    static constexpr int freeFlow = 32;
+
+    TravelProfiles() : slots(slotsPerDay, freeFlow) { index.emplace(hashOf(slots.data()), 0); }
+
+    // factors holds slotsPerDay values in 1..255.
+    uint32_t intern(const vector<uint8_t>& factors) {
+        uint64_t hash = hashOf(factors.data());
+        for (auto range = index.equal_range(hash); range.first != range.second; ++range.first) {
+            uint32_t id = range.first->second;
+            if (equal(factors.begin(), factors.end(), slots.begin() + static_cast<size_t>(id) * slotsPerDay)) return id;
+        }
+        uint32_t id = profileCount();
+        index.emplace(hash, id);
+        slots.insert(slots.end(), factors.begin(), factors.end());
+        fastest = min<int>(fastest, *min_element(factors.begin(), factors.end()));
+        return id;
+    }
+
+    uint32_t profileCount() const { return static_cast<uint32_t>(slots.size() / slotsPerDay); }
+
+    // Lowest factor of any profile, free flow included, for lower bounds on travel time.
+    int fastestFactor() const { return fastest; }
+
+    // Lays the per-route profile ids (keyed from << 32 | to) over g's edges.
+    void attach(const CsrGraph& g, const unordered_map<uint64_t, uint32_t>& routeProfiles) {
+        edgeProfiles.assign(routeProfiles.empty() ? 0 : g.edgeCount(), 0);
+        for (const auto& entry : routeProfiles) {
+            uint32_t from = static_cast<uint32_t>(entry.first >> 32), to = static_cast<uint32_t>(entry.first);
+            uint32_t e = from < g.nodeCount() ? g.edgeIndex(from, to) : UINT32_MAX;
+            if (e != UINT32_MAX) edgeProfiles[e] = entry.second;
+        }
+    }
+
+    // Seconds to cross edge e, of the given weight at secondsPerKm free flow, entered at `at`
+    // seconds (any day).
+    int travelSeconds(uint32_t e, int weight, long long at, int secondsPerKm) const {
+        long long base = static_cast<long long>(weight) * secondsPerKm;
+        uint32_t profile = edgeProfiles.empty() ? 0 : edgeProfiles[e];
+        if (profile != 0) {
+            const uint8_t* factors = slots.data() + static_cast<size_t>(profile) * slotsPerDay;
+            long long day = at % (24 * 3600);
+            uint32_t slot = static_cast<uint32_t>(day / secondsPerSlot);
+            long long offset = day % secondsPerSlot;
+            long long from = factors[slot], to = factors[(slot + 1) % slotsPerDay];
+            long long scale = static_cast<long long>(freeFlow) * secondsPerSlot;
+            base = (base * (from * secondsPerSlot + (to - from) * offset) + scale / 2) / scale;
+        }
+        return static_cast<int>(min<long long>(base, INT_MAX - 1));
+    }
+
+private:
+    vector<uint8_t> slots;  // profile id * slotsPerDay + slot
+    unordered_multimap<uint64_t, uint32_t> index;  // content hash -> profile id
+    vector<uint32_t> edgeProfiles;  // empty while no route has a profile
+    int fastest = freeFlow;
+
+    static uint64_t hashOf(const uint8_t* factors) {
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t i = 0; i < slotsPerDay; ++i) hash = (hash ^ factors[i]) * 1099511628211ull;
+        return hash;
+    }
+};
+
+
+enum class NodeOrder {
+    Auto,          // Hilbert when nine in ten locations have coordinates, Cuthill-McKee otherwise
+    Hilbert,       // along a space-filling curve; locations without coordinates go last
+    CuthillMcKee   // reverse Cuthill-McKee on the road graph alone
+};
+
+
+// Position of (x, y) along a Hilbert curve filling the 2^16 x 2^16 grid.
+uint64_t hilbertIndex(uint32_t x, uint32_t y) {
+    const uint32_t side = 1u << 16;
+    uint64_t index = 0;
+    for (uint32_t s = side / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            swap(x, y);
+        }
+    }
+    return index;
+}
+
+// The functions below return old ids in their new order.
+
+vector<uint32_t> hilbertOrder(const LocationTable& locations, uint32_t n) {
+    double minLatitude = numeric_limits<double>::infinity(), maxLatitude = -minLatitude;
+    double minLongitude = minLatitude, maxLongitude = maxLatitude;
+    for (uint32_t id = 0; id < n; ++id) {
+        double latitude, longitude;
+        if (!locations.coordinates(id, latitude, longitude)) continue;
+        minLatitude = min(minLatitude, latitude);
+        maxLatitude = max(maxLatitude, latitude);
+        minLongitude = min(minLongitude, longitude);
+        maxLongitude = max(maxLongitude, longitude);
+    }
+    auto scale = [](double value, double low, double high) {
+        return high > low ? static_cast<uint32_t>((value - low) / (high - low) * 65535.0) : 0u;
+    };
+    vector<pair<uint64_t, uint32_t>> keyed;
+    vector<uint32_t> unlocated;
+    for (uint32_t id = 0; id < n; ++id) {
+        double latitude, longitude;
+        if (!locations.coordinates(id, latitude, longitude)) {
+            unlocated.push_back(id);
+            continue;
+        }
+        keyed.push_back({hilbertIndex(scale(longitude, minLongitude, maxLongitude), scale(latitude, minLatitude, maxLatitude)), id});
+    }
+    sort(keyed.begin(), keyed.end());
+    vector<uint32_t> order;
+    order.reserve(n);
+    for (const auto& entry : keyed) order.push_back(entry.second);
+    order.insert(order.end(), unlocated.begin(), unlocated.end());
+    return order;
+}
+
+// Breadth-first from a pseudo-peripheral node of each component, neighbours by increasing
+// degree, then reversed. Relies on routes being two-way.
+vector<uint32_t> cuthillMcKeeOrder(const CsrGraph& g) {
+    uint32_t n = g.nodeCount();
+    auto degree = [&](uint32_t u) { return g.edgeEnd(u) - g.edgeBegin(u); };
+    vector<uint32_t> order, levels;
+    order.reserve(n);
+    vector<uint32_t> seen(n, 0);
+    vector<char> placed(n, 0);
+    uint32_t stamp = 0;
+    for (uint32_t seed = 0; seed < n; ++seed) {
+        if (placed[seed]) continue;
+        // Restart from the lowest-degree node of the deepest level until the depth stops growing.
+        uint32_t start = seed;
+        size_t depth = 0;
+        for (int round = 0; round < 8; ++round) {
+            ++stamp;
+            levels.assign(1, start);
+            seen[start] = stamp;
+            size_t levelBegin = 0, levelCount = 0;
+            while (levelBegin < levels.size()) {
+                size_t levelEnd = levels.size();
+                for (size_t i = levelBegin; i < levelEnd; ++i) {
+                    for (uint32_t e = g.edgeBegin(levels[i]); e < g.edgeEnd(levels[i]); ++e) {
+                        uint32_t v = g.target(e);
+                        if (seen[v] != stamp) {
+                            seen[v] = stamp;
+                            levels.push_back(v);
+                        }
+                    }
+                }
+                ++levelCount;
+                if (levels.size() == levelEnd) break;
+                levelBegin = levelEnd;
+            }
+            if (round > 0 && levelCount <= depth) break;
+            depth = levelCount;
+            uint32_t candidate = levels[levelBegin];
+            for (size_t i = levelBegin; i < levels.size(); ++i) {
+                if (degree(levels[i]) < degree(candidate)) candidate = levels[i];
+            }
+            start = candidate;
+        }
+
+        size_t first = order.size();
+        order.push_back(start);
+        placed[start] = 1;
+        for (size_t i = first; i < order.size(); ++i) {
+            size_t begin = order.size();
+            for (uint32_t e = g.edgeBegin(order[i]); e < g.edgeEnd(order[i]); ++e) {
+                uint32_t v = g.target(e);
+                if (!placed[v]) {
+                    placed[v] = 1;
+                    order.push_back(v);
+                }
+            }
+            sort(order.begin() + begin, order.end(), [&](uint32_t a, uint32_t b) {
+                return degree(a) != degree(b) ? degree(a) < degree(b) : a < b;
+            });
+        }
+    }
+    reverse(order.begin(), order.end());
+    return order;
+}
+
+// Resolves Auto to the method actually used.
+vector<uint32_t> localityOrder(const CsrGraph& g, const LocationTable& locations, NodeOrder& method) {
+    uint32_t n = g.nodeCount();
+    if (method == NodeOrder::Auto) {
+        uint32_t located = 0;
+        double latitude, longitude;
+        for (uint32_t id = 0; id < n; ++id) located += locations.coordinates(id, latitude, longitude);
+        method = located >= n - n / 10 ? NodeOrder::Hilbert : NodeOrder::CuthillMcKee;
+    }
+    return method == NodeOrder::Hilbert ? hilbertOrder(locations, n) : cuthillMcKeeOrder(g);
+}
+
+
+// Whole-file view: mmap where available, otherwise a heap copy. Pages are mapped private and
+// writable, so in-place edits (coordinates) never reach the file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes && copy.empty()) munmap(bytes, length);
+#endif
+    }
+
+    bool open(const string& path, string& error) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            error = "cannot read " + path;
+            return false;
+        }
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "cannot map " + path;
+            return false;
+        }
+        bytes = static_cast<char*>(mapped);
+        length = static_cast<size_t>(info.st_size);
+#else
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in || in.tellg() <= 0) {
+            error = "cannot read " + path;
+            return false;
+        }
+        copy.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(copy.data(), static_cast<streamsize>(copy.size()));
+        bytes = copy.data();
+        length = copy.size();
+#endif
+        return true;
+    }
+
+    char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    char* bytes = nullptr;
+    size_t length = 0;
+    vector<char> copy;
+};
+
+
+// One published, never modified version of the network. A graph adopted from a mapped file
+// keeps the mapping alive for as long as the version is.
+struct GraphSnapshot {
+    CsrGraph graph;
+    uint64_t version = 0;
+    shared_ptr<MappedFile> file;
+};
+
+
+// Publishes graph versions to lock-free readers and frees replaced ones by epoch. A Reader
+// announces the global epoch in its thread's slot, then loads the current version; publish
+// swaps the version in, bumps the epoch and retires the old one under the epoch it was
+// replaced in, and reclaim frees every retired version older than all announced epochs.
+// Readers never lock or wait; publish and reclaim must come from one writer at a time.
+class GraphVersions {
+    // One per thread that has read; never unlinked, so a scan can walk the list without locks.
+    // Declared ahead of Reader, which holds one.
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{0};  // 0 while not reading
+        unsigned depth = 0;         // owner thread only
+        Slot* next = nullptr;
+    };
+
+public:
+    GraphVersions() : serial(nextSerial()), current(new GraphSnapshot()) {}
+    GraphVersions(const GraphVersions&) = delete;
+    GraphVersions& operator=(const GraphVersions&) = delete;
+
+    ~GraphVersions() {
+        delete current.load();
+        for (const auto& entry : retired) delete entry.second;
+        for (Slot* slot = slots.load(); slot;) {
+            Slot* next = slot->next;
+            delete slot;
+            slot = next;
+        }
+    }
+
+    // Pins the latest version for the guard's lifetime. Nested guards on one thread share the
+    // outer pin.
+    class Reader {
+    public:
+        explicit Reader(GraphVersions& versions) : slot(versions.localSlot()) {
+            if (slot.depth++ == 0) {
+                uint64_t epoch = versions.epoch.load();
+                for (;;) {
+                    slot.epoch.store(epoch);
+                    uint64_t now = versions.epoch.load();
+                    if (now == epoch) break;
+                    epoch = now;
+                }
+            }
+            snapshot = versions.current.load();
+        }
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader() {
+            if (--slot.depth == 0) slot.epoch.store(0, memory_order_release);
+        }
+
+        const GraphSnapshot& operator*() const { return *snapshot; }
+        const GraphSnapshot* operator->() const { return snapshot; }
+
+    private:
+        Slot& slot;
+        const GraphSnapshot* snapshot;
+    };
+
+    // Writer side only; stays valid until the writer's next publish.
+    const GraphSnapshot& latest() const { return *current.load(memory_order_relaxed); }
+
+    void publish(unique_ptr<GraphSnapshot> next) {
+        GraphSnapshot* previous = current.exchange(next.release());
+        retired.push_back({epoch.fetch_add(1), previous});
+        reclaim();
+    }
+
+    // Returns how many replaced versions are still waiting for readers.
+    size_t reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (Slot* slot = slots.load(); slot; slot = slot->next) {
+            uint64_t pinned = slot->epoch.load();
+            if (pinned != 0) oldest = min(oldest, pinned);
+        }
+        size_t kept = 0;
+        for (const auto& entry : retired) {
+            if (entry.first < oldest) delete entry.second;
+            else retired[kept++] = entry;
+        }
+        retired.resize(kept);
+        return kept;
+    }
+
+private:
+    Slot& localSlot() {
+        // Keyed by a never-reused serial, as MetricsRegistry::local is.
+        thread_local uint64_t cachedSerial = 0;
+        thread_local Slot* cached = nullptr;
+        if (cachedSerial == serial) return *cached;
+        thread_local unordered_map<uint64_t, Slot*> threadSlots;
+        Slot*& slot = threadSlots[serial];
+        if (!slot) {
+            slot = new Slot();
+            slot->next = slots.load();
+            while (!slots.compare_exchange_weak(slot->next, slot)) {}
+        }
+        cachedSerial = serial;
+        cached = slot;
+        return *slot;
+    }
+
+    static uint64_t nextSerial() {
+        static atomic<uint64_t> serials{0};
+        return ++serials;
+    }
+
+    uint64_t serial;
+    atomic<GraphSnapshot*> current;
+    atomic<uint64_t> epoch{1};
+    atomic<Slot*> slots{nullptr};
+    vector<pair<uint64_t, GraphSnapshot*>> retired;  // replaced in epoch, version
+};
+
+
+// Versioned road-network snapshot. Every section starts on an 8-byte boundary at the offset
+// recorded here, so a mapped file is used in place:
+//   offsets   uint32[nodeCount + 1]   CSR row starts
+//   targets   uint32[edgeCount]       sorted per node
+//   weights   int32[edgeCount]
+//   coords    double[2 * nodeCount]   latitude/longitude, NaN when unknown
+//   nameIndex uint32[nodeCount + 1]   start of each name in the name blob
+//   sorted    uint32[nodeCount]       ids ordered by name, for lookups without a hash map
+//   names     char[nameBytes]
+struct NetworkFileHeader {
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+    uint64_t nameBytes;
+    uint64_t offsetsAt;
+    uint64_t targetsAt;
+    uint64_t weightsAt;
+    uint64_t coordinatesAt;
+    uint64_t nameIndexAt;
+    uint64_t sortedAt;
+    uint64_t namesAt;
+    uint64_t fileSize;
+};
+static_assert(sizeof(NetworkFileHeader) % 8 == 0, "sections after the header must stay aligned");
+
+const char networkFileMagic[8] = {'F', 'D', 'N', 'E', 'T', 'W', 'K', '\0'};
+
+
+enum class SearchMode {
+    Dijkstra,        // stops as soon as the target is settled
+    Bidirectional,   // meets in the middle; relies on routes being two-way
+    AStar,           // goal-directed with searchHeuristic
+    ContractionHierarchy,  // upward searches over a preprocessed hierarchy
+    Overlay          // full search only in the endpoints' regions, boundary overlay elsewhere
+};
+
+
+struct SearchStats {
+    uint32_t nodesSettled = 0;
+    uint32_t edgesRelaxed = 0;
+};
+
+
+// A point-to-point answer straight from the search. legs[i] is the weight of nodes[i] -> nodes[i+1]
+// and is only filled when asked for.
+struct PathResult {
+    int distance = INT_MAX;
+    vector<uint32_t> nodes;
+    vector<int> legs;
+
+    bool found() const { return distance != INT_MAX; }
+};
+
+
+// Lower bound on the remaining distance from a node to the target, in km.
+using SearchHeuristic = function<int(uint32_t node, uint32_t target)>;
+
+using FrontierQueue = priority_queue<pair<int, uint32_t>, vector<pair<int, uint32_t>>, greater<pair<int, uint32_t>>>;
+
+
+// Path length a + b, saturating at INT_MAX: a sum too long for an int reads as unreachable
+// instead of wrapping into a short one. Every relaxation goes through it.
+inline int addDistance(long long a, long long b) {
+    long long sum = a + b;
+    return sum < INT_MAX ? static_cast<int>(sum) : INT_MAX;
+}
+
+
+struct FrontierEntry {
+    int key;       // distance, or distance plus heuristic for A*
+    int distance;
+    uint32_t node;
+};
+
+
+// Min-heap order on (key, node) so ties break the same way on every run.
+struct FrontierOrder {
+    bool operator()(const FrontierEntry& a, const FrontierEntry& b) const {
+        return a.key != b.key ? a.key > b.key : a.node > b.node;
+    }
+};
+
+
+// Reusable per-node search state. A slot only counts as written when its stamp matches the
+// current generation, so starting a search is O(1) instead of refilling n-sized arrays.
+class SearchContext {
+public:
+    void begin(uint32_t nodeCount) {
+        if (slots.size() < nodeCount) slots.resize(nodeCount, Slot{0, INT_MAX, LocationTable::npos});
+        if (++generation == 0) {
+            for (Slot& slot : slots) slot.stamp = 0;
+            generation = 1;
+        }
+    }
+
+    int distance(uint32_t node) const {
+        const Slot& slot = slots[node];
+        return slot.stamp == generation ? slot.distance : INT_MAX;
+    }
+
+    uint32_t predecessor(uint32_t node) const {
+        const Slot& slot = slots[node];
+        return slot.stamp == generation ? slot.predecessor : LocationTable::npos;
+    }
+
+    void update(uint32_t node, int distance, uint32_t predecessor) {
+        slots[node] = Slot{generation, distance, predecessor};
+    }
+
+    vector<uint32_t> tracePath(uint32_t end) const {
+        vector<uint32_t> path;
+        for (uint32_t current = end; current != LocationTable::npos; current = predecessor(current)) {
+            path.push_back(current);
+        }
+        reverse(path.begin(), path.end());
+        return path;
+    }
+
+private:
+    struct Slot {
+        uint32_t stamp;
+        int distance;
+        uint32_t predecessor;
+    };
+
+    vector<Slot> slots;
+    uint32_t generation = 0;
+};
+
+
+// SearchContext without predecessors, for queries that only want the number: 8-byte slots and
+// no parent writes. update takes a predecessor only to share SearchContext's interface.
+class DistanceLabels {
+public:
+    void begin(uint32_t nodeCount) {
+        if (slots.size() < nodeCount) slots.resize(nodeCount, Slot{0, INT_MAX});
+        if (++generation == 0) {
+            for (Slot& slot : slots) slot.stamp = 0;
+            generation = 1;
+        }
+    }
+
+    int distance(uint32_t node) const {
+        const Slot& slot = slots[node];
+        return slot.stamp == generation ? slot.distance : INT_MAX;
+    }
+
+    void update(uint32_t node, int distance, uint32_t) { slots[node] = Slot{generation, distance}; }
+
+private:
+    struct Slot {
+        uint32_t stamp;
+        int distance;
+    };
+
+    vector<Slot> slots;
+    uint32_t generation = 0;
+};
+
+
+enum class FrontierKind {
+    BinaryHeap,      // lazy deletion: decrease-key pushes a duplicate
+    QuaternaryHeap,  // indexed 4-ary heap with true decrease-key
+    RadixHeap        // monotone integer keys only; lazy deletion like the binary heap
+};
+
+
+// All frontiers share this interface: begin, empty, size, push (insert or decrease), top, pop.
+// Callers still skip entries whose distance is stale, which only the lazy frontiers produce.
+class BinaryHeapFrontier {
+public:
+    void begin(uint32_t) { heap.clear(); }
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+    const FrontierEntry& top() { return heap.front(); }
+    void clear() { heap.clear(); }
+
+    void push(int key, int distance, uint32_t node) {
+        heap.push_back({key, distance, node});
+        push_heap(heap.begin(), heap.end(), FrontierOrder());
+    }
+
+    FrontierEntry pop() {
+        pop_heap(heap.begin(), heap.end(), FrontierOrder());
+        FrontierEntry entry = heap.back();
+        heap.pop_back();
+        return entry;
+    }
+
+private:
+    vector<FrontierEntry> heap;
+};
+
+
+class QuaternaryHeapFrontier {
+public:
+    void begin(uint32_t nodeCount) {
+        clear();
+        if (position.size() < nodeCount) position.resize(nodeCount, LocationTable::npos);
+    }
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+    const FrontierEntry& top() { return heap.front(); }
+
+    void clear() {
+        for (const FrontierEntry& entry : heap) position[entry.node] = LocationTable::npos;
+        heap.clear();
+    }
+
+    void push(int key, int distance, uint32_t node) {
+        uint32_t index = position[node];
+        if (index == LocationTable::npos) {
+            index = static_cast<uint32_t>(heap.size());
+            heap.push_back({key, distance, node});
+        } else {
+            if (!less(FrontierEntry{key, distance, node}, heap[index])) return;
+            heap[index] = {key, distance, node};
+        }
+        siftUp(index);
+    }
+
+    FrontierEntry pop() {
+        FrontierEntry entry = heap.front();
+        position[entry.node] = LocationTable::npos;
+        FrontierEntry last = heap.back();
+        heap.pop_back();
+        if (!heap.empty()) {
+            heap[0] = last;
+            position[last.node] = 0;
+            siftDown(0);
+        }
+        return entry;
+    }
+
+private:
+    vector<FrontierEntry> heap;
+    vector<uint32_t> position;
+
+    static bool less(const FrontierEntry& a, const FrontierEntry& b) { return FrontierOrder()(b, a); }
+
+    void place(uint32_t index, const FrontierEntry& entry) {
+        heap[index] = entry;
+        position[entry.node] = index;
+    }
+
+    void siftUp(uint32_t index) {
+        FrontierEntry entry = heap[index];
+        while (index > 0) {
+            uint32_t parent = (index - 1) / 4;
+            if (!less(entry, heap[parent])) break;
+            place(index, heap[parent]);
+            index = parent;
+        }
+        place(index, entry);
+    }
+
+    void siftDown(uint32_t index) {
+        FrontierEntry entry = heap[index];
+        uint32_t count = static_cast<uint32_t>(heap.size());
+        while (true) {
+            uint32_t first = index * 4 + 1;
+            if (first >= count) break;
+            uint32_t best = first;
+            uint32_t last = min(first + 4, count);
+            for (uint32_t child = first + 1; child < last; ++child) {
+                if (less(heap[child], heap[best])) best = child;
+            }
+            if (!less(heap[best], entry)) break;
+            place(index, heap[best]);
+            index = best;
+        }
+        place(index, entry);
+    }
+};
+
+
+// Buckets by the highest bit in which a key differs from the last popped minimum, so each
+// entry moves down at most 32 times. Keys must never drop below the last popped key, which
+// holds for Dijkstra over non-negative weights.
+class RadixHeapFrontier {
+public:
+    void begin(uint32_t) { clear(); }
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    void clear() {
+        for (auto& bucket : buckets) bucket.clear();
+        count = 0;
+        lastKey = 0;
+    }
+
+    void push(int key, int distance, uint32_t node) {
+        buckets[bucketFor(static_cast<uint32_t>(key))].push_back({key, distance, node});
+        ++count;
+    }
+
+    const FrontierEntry& top() {
+        refill();
+        return buckets[0].back();
+    }
+
+    FrontierEntry pop() {
+        refill();
+        FrontierEntry entry = buckets[0].back();
+        buckets[0].pop_back();
+        --count;
+        return entry;
+    }
+
+private:
+    vector<FrontierEntry> buckets[33];
+    size_t count = 0;
+    uint32_t lastKey = 0;
+
+    size_t bucketFor(uint32_t key) const {
+        return key == lastKey ? 0 : 32 - __builtin_clz(key ^ lastKey);
+    }
+
+    void refill() {
+        if (!buckets[0].empty()) return;
+        size_t i = 1;
+        while (buckets[i].empty()) ++i;
+        uint32_t minimum = UINT32_MAX;
+        for (const FrontierEntry& entry : buckets[i]) minimum = min(minimum, static_cast<uint32_t>(entry.key));
+        lastKey = minimum;
+        for (const FrontierEntry& entry : buckets[i]) buckets[bucketFor(static_cast<uint32_t>(entry.key))].push_back(entry);
+        buckets[i].clear();
+    }
+};
+
+
+// Min-plus row update, row[i] = min(row[i], offset + add[i]) for offset >= 0, in one variant per
+// instruction set; distanceKernels() picks the widest the CPU reports, once. INT_MAX means
+// unreachable and never wraps, as min(add, INT_MAX - offset) + offset saturates at it. Define
+// FD_NO_SIMD to build the scalar loop only.
+using MinPlusRowKernel = void (*)(int* row, const int* add, int offset, size_t count);
+
+void minPlusRowScalar(int* row, const int* add, int offset, size_t count) {
+    int ceiling = INT_MAX - offset;
+    for (size_t i = 0; i < count; ++i) row[i] = min(row[i], min(add[i], ceiling) + offset);
+}
+
+#if defined(FD_X86_KERNELS)
+__attribute__((target("avx2"))) void minPlusRowAvx2(int* row, const int* add, int offset, size_t count) {
+    __m256i ceiling = _mm256_set1_epi32(INT_MAX - offset);
+    __m256i shift = _mm256_set1_epi32(offset);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i candidate = _mm256_add_epi32(_mm256_min_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(add + i)), ceiling), shift);
+        __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + i), _mm256_min_epi32(current, candidate));
+    }
+    minPlusRowScalar(row + i, add + i, offset, count - i);
+}
+
+__attribute__((target("avx512f"))) void minPlusRowAvx512(int* row, const int* add, int offset, size_t count) {
+    __m512i ceiling = _mm512_set1_epi32(INT_MAX - offset);
+    __m512i shift = _mm512_set1_epi32(offset);
+    for (size_t i = 0; i < count; i += 16) {
+        __mmask16 lanes = count - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (count - i)) - 1);
+        // The maskz forms of min also keep GCC from tracing an undefined pass-through operand.
+        __m512i candidate = _mm512_add_epi32(_mm512_maskz_min_epi32(lanes, _mm512_maskz_loadu_epi32(lanes, add + i), ceiling), shift);
+        __m512i current = _mm512_maskz_loadu_epi32(lanes, row + i);
+        _mm512_mask_storeu_epi32(row + i, lanes, _mm512_maskz_min_epi32(lanes, current, candidate));
+    }
+}
+#elif defined(FD_NEON_KERNELS)
+void minPlusRowNeon(int* row, const int* add, int offset, size_t count) {
+    int32x4_t ceiling = vdupq_n_s32(INT_MAX - offset);
+    int32x4_t shift = vdupq_n_s32(offset);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t candidate = vaddq_s32(vminq_s32(vld1q_s32(add + i), ceiling), shift);
+        vst1q_s32(row + i, vminq_s32(vld1q_s32(row + i), candidate));
+    }
+    minPlusRowScalar(row + i, add + i, offset, count - i);
+}
+#endif
+
+struct DistanceKernels {
+    const char* name;
+    MinPlusRowKernel minPlusRow;
+};
+
+const DistanceKernels& distanceKernels() {
+    static const DistanceKernels kernels = [] {
+#if defined(FD_X86_KERNELS)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return DistanceKernels{"avx512", minPlusRowAvx512};
+        if (__builtin_cpu_supports("avx2")) return DistanceKernels{"avx2", minPlusRowAvx2};
+#elif defined(FD_NEON_KERNELS)
+        return DistanceKernels{"neon", minPlusRowNeon};
+#endif
+        return DistanceKernels{"scalar", minPlusRowScalar};
+    }();
+    return kernels;
+}
+
+
+struct BucketEntry {
+    uint32_t column;
+    int distance;
+    uint32_t next;
+};
+
+
+// Everything one thread needs to run any of the searches without allocating in steady state.
+// Frontiers keep their capacity between searches.
+struct SearchWorkspace {
+    SearchContext sides[2];       // forward / backward
+    SearchContext marks;          // per-node side table: target flags, CH bucket list heads
+    DistanceLabels distances;     // distance-only point-to-point queries
+    vector<BucketEntry> buckets;
+    vector<uint32_t> bucketNodes;  // nodes with a CH bucket, in first-touch order
+    vector<int> hubRows;           // dense CH buckets, one row per busy node
+    BinaryHeapFrontier binary[2];
+    QuaternaryHeapFrontier quaternary[2];
+    RadixHeapFrontier radix[2];
+};
+
+
+// Searches on one thread never nest, so each thread borrows a single workspace.
+SearchWorkspace& threadSearchWorkspace() {
+    thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+
+// Edge cost policies for labelSetting: cost(e, label) is what entering edge e at label adds.
+struct StaticWeights {
+    const CsrGraph& g;
+    int cost(uint32_t e, int) const { return g.weight(e); }
+};
+
+// Labels are seconds since departure; each edge costs its travel time when it is entered.
+struct TimeDependentWeights {
+    const CsrGraph& g;
+    const TravelProfiles& profiles;
+    long long departure;
+    int secondsPerKm;
+    long long cost(uint32_t e, int label) const {
+        return profiles.travelSeconds(e, g.weight(e), departure + label, secondsPerKm);
+    }
+};
+
+// Plain Dijkstra; A* passes its lower bound instead.
+struct NoBound {
+    int operator()(uint32_t) const { return 0; }
+};
+
+
+// The one label-setting loop behind the single-source searches. Weights prices an edge, Labels
+// keeps what the answer needs (DistanceLabels, SearchContext for a path, TreeLabels for a whole
+// tree), Bound is a lower bound to the target for A*, and Frontier is any heap. Every
+// combination is its own instantiation, so a distance-only Dijkstra never writes a
+// predecessor and a static search never looks at a profile. Stops once end is settled (pass
+// LocationTable::npos to settle everything) and returns whether it was.
+template <typename Weights, typename Labels, typename Bound, typename Frontier>
+bool labelSetting(const CsrGraph& g, const Weights& weights, Labels& labels, const Bound& bound, uint32_t start,
+                  uint32_t end, Frontier& frontier, SearchStats& stats) {
+    labels.begin(g.nodeCount());
+    frontier.begin(g.nodeCount());
+    labels.update(start, 0, LocationTable::npos);
+    frontier.push(bound(start), 0, start);
+
+    while (!frontier.empty()) {
+        FrontierEntry entry = frontier.pop();
+        uint32_t current = entry.node;
+        int dist = entry.distance;
+
+        if (dist > labels.distance(current)) continue;
+        ++stats.nodesSettled;
+        if (current == end) return true;
+
+        for (uint32_t e = g.edgeBegin(current); e < g.edgeEnd(current); ++e) {
+            uint32_t neighbor = g.target(e);
+            int candidate = addDistance(dist, weights.cost(e, dist));
+            ++stats.edgesRelaxed;
+            if (candidate < labels.distance(neighbor)) {
+                labels.update(neighbor, candidate, current);
+                frontier.push(addDistance(candidate, bound(neighbor)), candidate, neighbor);
+            }
+        }
+    }
+    return false;
+}
+
+
+// Great-circle distance in km; admissible as long as no route is shorter than the straight line.
+double haversineKm(double latitudeA, double longitudeA, double latitudeB, double longitudeB) {
+    const double earthRadiusKm = 6371.0;
+    const double toRadians = M_PI / 180.0;
+    double dLat = (latitudeB - latitudeA) * toRadians;
+    double dLon = (longitudeB - longitudeA) * toRadians;
+    double h = sin(dLat / 2) * sin(dLat / 2) +
+               cos(latitudeA * toRadians) * cos(latitudeB * toRadians) * sin(dLon / 2) * sin(dLon / 2);
+    return 2 * earthRadiusKm * asin(min(1.0, sqrt(h)));
+}
+
+
+// Uniform latitude/longitude bucket grid over dense item ids, with O(1) place, move and remove.
+// Items without coordinates live in a side list that every search visits first. Searches walk
+// square rings of cells outward; after each ring, more(boundKm) is told a straight-line lower
+// bound for every item not yet visited and returns whether to keep going.
+class SpatialGrid {
+public:
+    explicit SpatialGrid(double cellKm) : cellDegrees(cellKm / kmPerDegree) {}
+
+    void clear() {
+        cells.clear();
+        slots.clear();
+        unlocated.clear();
+        count = 0;
+        extentsSet = false;
+        maxAbsLatitude = 0;
+    }
+
+    size_t size() const { return count; }
+
+    bool located(uint32_t item) const { return item < slots.size() && slots[item].placed && slots[item].cell != unlocatedKey; }
+
+    void place(uint32_t item, double latitude, double longitude) {
+        remove(item);
+        int32_t row = static_cast<int32_t>(floor(latitude / cellDegrees));
+        int32_t col = static_cast<int32_t>(floor(longitude / cellDegrees));
+        if (!extentsSet) {
+            minRow = maxRow = row;
+            minCol = maxCol = col;
+            extentsSet = true;
+        }
+        minRow = min(minRow, row);
+        maxRow = max(maxRow, row);
+        minCol = min(minCol, col);
+        maxCol = max(maxCol, col);
+        maxAbsLatitude = max(maxAbsLatitude, fabs(latitude));
+        add(item, cells[cellKey(row, col)], cellKey(row, col));
+    }
+
+    void placeUnlocated(uint32_t item) {
+        remove(item);
+        add(item, unlocated, unlocatedKey);
+    }
+
+    void remove(uint32_t item) {
+        if (item >= slots.size() || !slots[item].placed) return;
+        Slot& slot = slots[item];
+        vector<uint32_t>& bucket = slot.cell == unlocatedKey ? unlocated : cells.find(slot.cell)->second;
+        bucket[slot.index] = bucket.back();
+        slots[bucket[slot.index]].index = slot.index;
+        bucket.pop_back();
+        slot.placed = false;
+        --count;
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (uint32_t item : unlocated) visit(item);
+        for (const auto& cell : cells) {
+            for (uint32_t item : cell.second) visit(item);
+        }
+    }
+
+    template <typename Visit, typename More>
+    void search(double latitude, double longitude, Visit visit, More more) const {
+        for (uint32_t item : unlocated) visit(item);
+        if (!extentsSet) {
+            more(numeric_limits<double>::infinity());
+            return;
+        }
+        int32_t row = static_cast<int32_t>(floor(latitude / cellDegrees));
+        int32_t col = static_cast<int32_t>(floor(longitude / cellDegrees));
+        int32_t lastRing = max(max(row - minRow, maxRow - row), max(col - minCol, maxCol - col));
+        // Anything beyond ring r is r whole cells away along one axis; longitude cells shrink
+        // with latitude, so the bound uses the narrowest width seen.
+        double ringKm = cellDegrees * kmPerDegree * cos(min(89.0, max(maxAbsLatitude, fabs(latitude))) * M_PI / 180.0);
+        for (int32_t ring = 0; ring <= max(lastRing, 0); ++ring) {
+            for (int32_t r = row - ring; r <= row + ring; ++r) {
+                bool edge = r == row - ring || r == row + ring;
+                for (int32_t c = col - ring; c <= col + ring; c += edge || ring == 0 ? 1 : 2 * ring) {
+                    auto it = cells.find(cellKey(r, c));
+                    if (it == cells.end()) continue;
+                    for (uint32_t item : it->second) visit(item);
+                }
+            }
+            if (!more(ring >= lastRing ? numeric_limits<double>::infinity() : ring * ringKm)) return;
+        }
+    }
+
+private:
+    static constexpr double kmPerDegree = 6371.0 * M_PI / 180.0;
+    static constexpr uint64_t unlocatedKey = UINT64_MAX;
+
+    struct Slot {
+        uint64_t cell = 0;
+        uint32_t index = 0;
+        bool placed = false;
+    };
+
+    static uint64_t cellKey(int32_t row, int32_t col) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) | static_cast<uint32_t>(col);
+    }
+
+    void add(uint32_t item, vector<uint32_t>& bucket, uint64_t key) {
+        if (item >= slots.size()) slots.resize(item + 1);
+        slots[item] = Slot{key, static_cast<uint32_t>(bucket.size()), true};
+        bucket.push_back(item);
+        ++count;
+    }
+
+    double cellDegrees;
+    unordered_map<uint64_t, vector<uint32_t>> cells;
+    vector<Slot> slots;
+    vector<uint32_t> unlocated;
+    size_t count = 0;
+    bool extentsSet = false;
+    int32_t minRow = 0, maxRow = 0, minCol = 0, maxCol = 0;
+    double maxAbsLatitude = 0;
+};
+
+
+// Contraction Hierarchies over the two-way delivery graph. Nodes are contracted in order of
+// edge difference; a query runs an upward search from both ends and meets at the highest node.
+class ContractionHierarchy {
+public:
+    bool empty() const { return rank.empty(); }
+    uint32_t nodeCount() const { return static_cast<uint32_t>(rank.size()); }
+    size_t shortcutCount() const { return shortcuts; }
+
+    void build(const CsrGraph& g) {
+        initialize(g);
+        uint32_t n = g.nodeCount();
+        priority_queue<pair<int, uint32_t>, vector<pair<int, uint32_t>>, greater<pair<int, uint32_t>>> queue;
+        for (uint32_t v = 0; v < n; ++v) {
+            queue.push({contractionPriority(v), v});
+        }
+        // Lazy updates: a popped node is only contracted if its refreshed priority is still minimal.
+        while (!queue.empty()) {
+            uint32_t v = queue.top().second;
+            queue.pop();
+            if (contracted[v]) continue;
+            int priority = contractionPriority(v);
+            if (!queue.empty() && priority > queue.top().first) {
+                queue.push({priority, v});
+                continue;
+            }
+            contractNode(v, true);
+            order.push_back(v);
+        }
+        finalize();
+    }
+
+    // Re-contracts with the existing node order after weights change. The order only affects
+    // query speed, so results stay exact while the priority computation is skipped.
+    void customize(const CsrGraph& g) {
+        if (order.size() != g.nodeCount()) {
+            build(g);
+            return;
+        }
+        vector<uint32_t> previousOrder = move(order);
+        initialize(g);
+        for (uint32_t v : previousOrder) {
+            contractNode(v, true);
+        }
+        order = move(previousOrder);
+        finalize();
+    }
+
+    int distance(uint32_t start, uint32_t end, SearchStats& stats) const {
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        uint32_t meeting = search(start, end, workspace, stats);
+        if (meeting == LocationTable::npos) return INT_MAX;
+        return workspace.sides[0].distance(meeting) + workspace.sides[1].distance(meeting);
+    }
+
+    PathResult path(uint32_t start, uint32_t end, SearchStats& stats) const {
+        PathResult result;
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        uint32_t meeting = search(start, end, workspace, stats);
+        if (meeting == LocationTable::npos) return result;
+        const SearchContext& forward = workspace.sides[0];
+        const SearchContext& backward = workspace.sides[1];
+        result.distance = forward.distance(meeting) + backward.distance(meeting);
+
+        vector<uint32_t> upToMeeting = forward.tracePath(meeting);
+        result.nodes = {start};
+        for (size_t i = 0; i + 1 < upToMeeting.size(); ++i) {
+            unpackArc(upToMeeting[i], upToMeeting[i + 1], result.nodes);
+        }
+        for (uint32_t current = meeting; backward.predecessor(current) != LocationTable::npos;
+             current = backward.predecessor(current)) {
+            unpackArc(current, backward.predecessor(current), result.nodes);
+        }
+        return result;
+    }
+
+    // Bucket-based many-to-many: one upward search per target fills per-node buckets, then one
+    // upward search per source scans them. Nodes high in the hierarchy collect entries from most
+    // targets, so buckets at least 1/hubFill full are laid out as dense rows over all targets and
+    // scanned with the min-plus kernel; the rest stay linked lists. values is row-major,
+    // sources x targets.
+    void manyToMany(const vector<uint32_t>& sources, const vector<uint32_t>& targets, vector<int>& values,
+                    SearchStats& stats) const {
+        values.assign(sources.size() * targets.size(), INT_MAX);
+        uint32_t n = nodeCount();
+        size_t columns = targets.size();
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        SearchContext& heads = workspace.marks;  // distance: bucket size, predecessor: list head or hub row
+        vector<BucketEntry>& buckets = workspace.buckets;
+        vector<uint32_t>& bucketNodes = workspace.bucketNodes;
+        heads.begin(n);
+        buckets.clear();
+        bucketNodes.clear();
+
+        for (uint32_t column = 0; column < columns; ++column) {
+            if (targets[column] >= n) continue;
+            upwardSpace(targets[column], workspace.sides[0], workspace.binary[0], stats, [&](uint32_t node, int dist) {
+                int size = heads.distance(node);
+                if (size == INT_MAX) {
+                    size = 0;
+                    bucketNodes.push_back(node);
+                }
+                buckets.push_back({column, dist, heads.predecessor(node)});
+                heads.update(node, size + 1, static_cast<uint32_t>(buckets.size() - 1));
+            });
+        }
+
+        vector<int>& hubRows = workspace.hubRows;
+        hubRows.clear();
+        for (uint32_t node : bucketNodes) {
+            if (static_cast<size_t>(heads.distance(node)) * hubFill < columns) continue;
+            size_t hub = hubRows.size() / columns;
+            hubRows.resize(hubRows.size() + columns, INT_MAX);
+            int* row = hubRows.data() + hub * columns;
+            for (uint32_t b = heads.predecessor(node); b != LocationTable::npos; b = buckets[b].next) {
+                row[buckets[b].column] = buckets[b].distance;
+            }
+            heads.update(node, heads.distance(node), hubFlag | static_cast<uint32_t>(hub));
+        }
+
+        MinPlusRowKernel minPlusRow = distanceKernels().minPlusRow;
+        for (size_t row = 0; row < sources.size(); ++row) {
+            if (sources[row] >= n) continue;
+            int* rowValues = values.data() + row * columns;
+            upwardSpace(sources[row], workspace.sides[0], workspace.binary[0], stats, [&](uint32_t node, int dist) {
+                uint32_t head = heads.predecessor(node);
+                if (head != LocationTable::npos && (head & hubFlag)) {
+                    minPlusRow(rowValues, hubRows.data() + (head & ~hubFlag) * columns, dist, columns);
+                    return;
+                }
+                for (uint32_t b = head; b != LocationTable::npos; b = buckets[b].next) {
+                    const BucketEntry& entry = buckets[b];
+                    rowValues[entry.column] = min(rowValues[entry.column], addDistance(dist, entry.distance));
+                }
+            });
+        }
+    }
+
+private:
+    struct Arc {
+        uint32_t to;
+        int weight;
+        uint32_t middle;  // contracted node a shortcut bypasses, npos for an original route
+    };
+
+    static constexpr uint32_t witnessSettleLimit = 500;
+    static constexpr size_t hubFill = 16;
+    static constexpr uint32_t hubFlag = 0x80000000u;  // bucket heads below it index buckets
+
+    vector<vector<Arc>> remaining;
+    vector<vector<Arc>> upward;
+    vector<char> contracted;
+    vector<int> contractedNeighbors;
+    vector<uint32_t> order;
+    vector<uint32_t> rank;
+    vector<uint32_t> upOffsets;
+    vector<Arc> upArcs;
+    size_t shortcuts = 0;
+
+    vector<int> witnessDistances;
+    vector<uint32_t> witnessTouched;
+
+    void initialize(const CsrGraph& g) {
+        uint32_t n = g.nodeCount();
+        remaining.assign(n, {});
+        upward.assign(n, {});
+        contracted.assign(n, 0);
+        contractedNeighbors.assign(n, 0);
+        witnessDistances.assign(n, INT_MAX);
+        order.clear();
+        shortcuts = 0;
+        for (uint32_t u = 0; u < n; ++u) {
+            for (uint32_t e = g.edgeBegin(u); e < g.edgeEnd(u); ++e) {
+                if (g.target(e) != u) addOrImprove(remaining[u], g.target(e), g.weight(e), LocationTable::npos);
+            }
+        }
+    }
+
+    static bool addOrImprove(vector<Arc>& arcs, uint32_t to, int weight, uint32_t middle) {
+        for (Arc& arc : arcs) {
+            if (arc.to == to) {
+                if (weight >= arc.weight) return false;
+                arc.weight = weight;
+                arc.middle = middle;
+                return true;
+            }
+        }
+        arcs.push_back({to, weight, middle});
+        return true;
+    }
+
+    // Local Dijkstra from source that ignores contracted nodes and the node being contracted.
+    void witnessSearch(uint32_t source, uint32_t excluded, int limit) {
+        for (uint32_t v : witnessTouched) witnessDistances[v] = INT_MAX;
+        witnessTouched.clear();
+
+        FrontierQueue pq;
+        witnessDistances[source] = 0;
+        witnessTouched.push_back(source);
+        pq.push({0, source});
+        uint32_t settled = 0;
+
+        while (!pq.empty() && settled < witnessSettleLimit) {
+            int dist = pq.top().first;
+            uint32_t current = pq.top().second;
+            pq.pop();
+            if (dist > witnessDistances[current]) continue;
+            if (dist > limit) break;
+            ++settled;
+            for (const Arc& arc : remaining[current]) {
+                if (arc.to == excluded || contracted[arc.to]) continue;
+                int candidate = addDistance(dist, arc.weight);
+                if (candidate < witnessDistances[arc.to]) {
+                    if (witnessDistances[arc.to] == INT_MAX) witnessTouched.push_back(arc.to);
+                    witnessDistances[arc.to] = candidate;
+                    pq.push({candidate, arc.to});
+                }
+            }
+        }
+    }
+
+    // Adds (or, when apply is false, only counts) the shortcuts needed to contract v.
+    int contractNode(uint32_t v, bool apply) {
+        vector<Arc> neighbors;
+        for (const Arc& arc : remaining[v]) {
+            if (!contracted[arc.to]) neighbors.push_back(arc);
+        }
+
+        int added = 0;
+        int maxOutgoing = 0;
+        for (const Arc& arc : neighbors) maxOutgoing = max(maxOutgoing, arc.weight);
+
+        for (size_t i = 0; i < neighbors.size(); ++i) {
+            const Arc& in = neighbors[i];
+            witnessSearch(in.to, v, addDistance(in.weight, maxOutgoing));
+            for (size_t j = i + 1; j < neighbors.size(); ++j) {
+                const Arc& out = neighbors[j];
+                int via = addDistance(in.weight, out.weight);
+                if (witnessDistances[out.to] <= via) continue;
+                ++added;
+                if (apply) {
+                    if (addOrImprove(remaining[in.to], out.to, via, v)) ++shortcuts;
+                    addOrImprove(remaining[out.to], in.to, via, v);
+                }
+            }
+        }
+
+        if (apply) {
+            contracted[v] = 1;
+            upward[v] = neighbors;
+            for (const Arc& arc : neighbors) ++contractedNeighbors[arc.to];
+        }
+        return added - static_cast<int>(neighbors.size());
+    }
+
+    int contractionPriority(uint32_t v) {
+        return contractNode(v, false) + contractedNeighbors[v];
+    }
+
+    void finalize() {
+        uint32_t n = static_cast<uint32_t>(upward.size());
+        rank.assign(n, 0);
+        for (uint32_t i = 0; i < order.size(); ++i) rank[order[i]] = i;
+
+        upOffsets.assign(n + 1, 0);
+        upArcs.clear();
+        for (uint32_t v = 0; v < n; ++v) {
+            sort(upward[v].begin(), upward[v].end(), [](const Arc& a, const Arc& b) { return a.to < b.to; });
+            upArcs.insert(upArcs.end(), upward[v].begin(), upward[v].end());
+            upOffsets[v + 1] = static_cast<uint32_t>(upArcs.size());
+        }
+
+        remaining.clear();
+        upward.clear();
+        witnessDistances.clear();
+        witnessTouched.clear();
+    }
+
+    // Settles the whole upward search space of source, calling visit(node, distance) per node.
+    template <typename Visit>
+    void upwardSpace(uint32_t source, SearchContext& context, BinaryHeapFrontier& frontier, SearchStats& stats,
+                     Visit visit) const {
+        context.begin(nodeCount());
+        frontier.begin(nodeCount());
+        context.update(source, 0, LocationTable::npos);
+        frontier.push(0, 0, source);
+
+        while (!frontier.empty()) {
+            FrontierEntry entry = frontier.pop();
+            if (entry.distance > context.distance(entry.node)) continue;
+            ++stats.nodesSettled;
+            visit(entry.node, entry.distance);
+
+            for (uint32_t a = upOffsets[entry.node]; a < upOffsets[entry.node + 1]; ++a) {
+                const Arc& arc = upArcs[a];
+                int candidate = addDistance(entry.distance, arc.weight);
+                ++stats.edgesRelaxed;
+                if (candidate < context.distance(arc.to)) {
+                    context.update(arc.to, candidate, entry.node);
+                    frontier.push(candidate, candidate, arc.to);
+                }
+            }
+        }
+    }
+
+    // Upward search from both ends; returns the meeting node with the smallest total distance.
+    uint32_t search(uint32_t start, uint32_t end, SearchWorkspace& workspace, SearchStats& stats) const {
+        SearchContext* sides = workspace.sides;
+        BinaryHeapFrontier* frontiers = workspace.binary;
+        for (int side = 0; side < 2; ++side) {
+            sides[side].begin(nodeCount());
+            frontiers[side].begin(nodeCount());
+        }
+        sides[0].update(start, 0, LocationTable::npos);
+        sides[1].update(end, 0, LocationTable::npos);
+        frontiers[0].push(0, 0, start);
+        frontiers[1].push(0, 0, end);
+
+        int best = start == end ? 0 : INT_MAX;
+        uint32_t meeting = start == end ? start : LocationTable::npos;
+
+        while (!frontiers[0].empty() || !frontiers[1].empty()) {
+            for (int side = 0; side < 2; ++side) {
+                SearchContext& context = sides[side];
+                BinaryHeapFrontier& frontier = frontiers[side];
+                if (frontier.empty()) continue;
+                if (frontier.top().distance >= best) {
+                    frontier.clear();
+                    continue;
+                }
+                FrontierEntry entry = frontier.pop();
+                if (entry.distance > context.distance(entry.node)) continue;
+                ++stats.nodesSettled;
+
+                int other = sides[1 - side].distance(entry.node);
+                if (other != INT_MAX && addDistance(entry.distance, other) < best) {
+                    best = addDistance(entry.distance, other);
+                    meeting = entry.node;
+                }
+
+                for (uint32_t a = upOffsets[entry.node]; a < upOffsets[entry.node + 1]; ++a) {
+                    const Arc& arc = upArcs[a];
+                    int candidate = addDistance(entry.distance, arc.weight);
+                    ++stats.edgesRelaxed;
+                    if (candidate < context.distance(arc.to)) {
+                        context.update(arc.to, candidate, entry.node);
+                        frontier.push(candidate, candidate, arc.to);
+                    }
+                }
+            }
+        }
+        return meeting;
+    }
+
+    const Arc& findArc(uint32_t a, uint32_t b) const {
+        uint32_t lower = rank[a] < rank[b] ? a : b;
+        uint32_t higher = lower == a ? b : a;
+        auto first = upArcs.begin() + upOffsets[lower];
+        auto last = upArcs.begin() + upOffsets[lower + 1];
+        return *lower_bound(first, last, higher, [](const Arc& arc, uint32_t to) { return arc.to < to; });
+    }
+
+    // Appends the original route nodes between from (exclusive) and to (inclusive).
+    void unpackArc(uint32_t from, uint32_t to, vector<uint32_t>& out) const {
+        vector<pair<uint32_t, uint32_t>> pending = {{from, to}};
+        while (!pending.empty()) {
+            pair<uint32_t, uint32_t> arcEnds = pending.back();
+            pending.pop_back();
+            const Arc& arc = findArc(arcEnds.first, arcEnds.second);
+            if (arc.middle == LocationTable::npos) {
+                out.push_back(arcEnds.second);
+            } else {
+                pending.push_back({arc.middle, arcEnds.second});
+                pending.push_back({arcEnds.first, arc.middle});
+            }
+        }
+    }
+};
+
+
+// One-level partition overlay in the style of multi-level Dijkstra. Regions are runs of
+// consecutive nodes in a locality order; a boundary node has a route into another region.
+// Every boundary node keeps shortcuts to the boundary nodes of its own region that it reaches
+// inside the region, except those whose shortest path already crosses another boundary node
+// strictly between the two (which keeps zero-weight routes from pruning each other away).
+// A query runs plain Dijkstra inside the start and end regions and crosses every other region
+// on the overlay alone: shortcuts plus the routes between regions. Shortcuts are expanded by a
+// search confined to their region, so a region only ever needs its own nodes and the overlay.
+class RegionOverlay {
+public:
+    bool empty() const { return region.empty(); }
+    uint32_t nodeCount() const { return static_cast<uint32_t>(region.size()); }
+    uint32_t regionCount() const { return regions; }
+    uint32_t regionOf(uint32_t node) const { return region[node]; }
+    size_t boundaryCount() const { return boundaryNodes; }
+    size_t shortcutCount() const { return shortcutTargets.size(); }
+
+    void build(const CsrGraph& g, const vector<uint32_t>& order, uint32_t regionSize) {
+        uint32_t n = g.nodeCount();
+        regionSize = max(regionSize, 1u);
+        regions = (n + regionSize - 1) / regionSize;
+        members = order;
+        region.assign(n, 0);
+        for (uint32_t i = 0; i < n; ++i) region[order[i]] = i / regionSize;
+        memberOffsets.assign(regions + 1, n);
+        for (uint32_t r = 0; r < regions; ++r) memberOffsets[r] = r * regionSize;
+        customize(g);
+    }
+
+    // Recomputes the boundary and the shortcuts after route changes, new routes included; the
+    // regions stay.
+    void customize(const CsrGraph& g) {
+        uint32_t n = nodeCount();
+        boundary.assign(n, 0);
+        boundaryNodes = 0;
+        for (uint32_t u = 0; u < n; ++u) {
+            for (uint32_t e = g.edgeBegin(u); e < g.edgeEnd(u) && !boundary[u]; ++e) boundary[u] = region[g.target(e)] != region[u];
+            boundaryNodes += boundary[u];
+        }
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        SearchContext& context = workspace.sides[0];
+        // Closest positive distance at which a shortest path from the source crosses another
+        // boundary node; a shortcut is redundant when that is below the target's own distance.
+        vector<int>& via = crossings;
+        via.assign(n, INT_MAX);
+        SearchStats stats;
+        shortcutOffsets.assign(n + 1, 0);
+        vector<vector<pair<uint32_t, int>>> found(n);
+        for (uint32_t u = 0; u < n; ++u) {
+            if (!boundary[u]) continue;
+            localSearch(g, u, LocationTable::npos, context, workspace.binary[0], stats,
+                        [&](uint32_t from, uint32_t to, bool improved) {
+                            int crosses = via[from];
+                            int dist = context.distance(from);
+                            if (from != u && boundary[from] && dist > 0) crosses = min(crosses, dist);
+                            via[to] = improved ? crosses : min(via[to], crosses);
+                        });
+            for (uint32_t i = memberOffsets[region[u]]; i < memberOffsets[region[u] + 1]; ++i) {
+                uint32_t v = members[i];
+                int dist = context.distance(v);
+                if (v != u && boundary[v] && dist != INT_MAX && via[v] >= dist) found[u].push_back({v, dist});
+                via[v] = INT_MAX;
+            }
+        }
+        for (uint32_t u = 0; u < n; ++u) shortcutOffsets[u + 1] = shortcutOffsets[u] + static_cast<uint32_t>(found[u].size());
+        shortcutTargets.resize(shortcutOffsets[n]);
+        shortcutWeights.resize(shortcutOffsets[n]);
+        for (uint32_t u = 0; u < n; ++u) {
+            uint32_t s = shortcutOffsets[u];
+            for (const auto& shortcut : found[u]) {
+                shortcutTargets[s] = shortcut.first;
+                shortcutWeights[s++] = shortcut.second;
+            }
+        }
+    }
+
+    int distance(const CsrGraph& g, uint32_t start, uint32_t end, SearchStats& stats) const {
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        search(g, start, end, workspace, stats);
+        return workspace.sides[0].distance(end);
+    }
+
+    PathResult path(const CsrGraph& g, uint32_t start, uint32_t end, SearchStats& stats) const {
+        PathResult result;
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        search(g, start, end, workspace, stats);
+        result.distance = workspace.sides[0].distance(end);
+        if (result.distance == INT_MAX) return result;
+        vector<uint32_t> hops = workspace.sides[0].tracePath(end);
+        result.nodes = {start};
+        for (size_t i = 0; i + 1 < hops.size(); ++i) {
+            uint32_t from = hops[i], to = hops[i + 1];
+            uint32_t r = region[from];
+            if (r != region[to] || r == region[start] || r == region[end]) {
+                result.nodes.push_back(to);
+                continue;
+            }
+            SearchContext& local = workspace.sides[1];
+            localSearch(g, from, to, local, workspace.binary[1], stats, [](uint32_t, uint32_t, bool) {});
+            vector<uint32_t> inside = local.tracePath(to);
+            result.nodes.insert(result.nodes.end(), inside.begin() + 1, inside.end());
+        }
+        return result;
+    }
+
+private:
+    uint32_t regions = 0;
+    size_t boundaryNodes = 0;
+    vector<uint32_t> region;
+    vector<uint32_t> members;        // grouped by region
+    vector<uint32_t> memberOffsets;  // regions + 1
+    vector<char> boundary;
+    vector<int> crossings;
+    vector<uint32_t> shortcutOffsets;
+    vector<uint32_t> shortcutTargets;
+    vector<int> shortcutWeights;
+
+    // Dijkstra from start that never leaves start's region; stops once stop is settled.
+    // relaxed(from, to, improved) sees every relaxation that improves or ties to's distance.
+    template <typename Relaxed>
+    void localSearch(const CsrGraph& g, uint32_t start, uint32_t stop, SearchContext& context, BinaryHeapFrontier& frontier,
+                     SearchStats& stats, Relaxed relaxed) const {
+        uint32_t home = region[start];
+        context.begin(nodeCount());
+        frontier.begin(nodeCount());
+        context.update(start, 0, LocationTable::npos);
+        frontier.push(0, 0, start);
+        while (!frontier.empty()) {
+            FrontierEntry entry = frontier.pop();
+            if (entry.distance > context.distance(entry.node)) continue;
+            ++stats.nodesSettled;
+            if (entry.node == stop) return;
+            for (uint32_t e = g.edgeBegin(entry.node); e < g.edgeEnd(entry.node); ++e) {
+                uint32_t to = g.target(e);
+                if (region[to] != home) continue;
+                ++stats.edgesRelaxed;
+                int candidate = addDistance(entry.distance, g.weight(e));
+                int current = context.distance(to);
+                if (candidate < current) {
+                    context.update(to, candidate, entry.node);
+                    frontier.push(candidate, candidate, to);
+                    relaxed(entry.node, to, true);
+                } else if (candidate == current) {
+                    relaxed(entry.node, to, false);
+                }
+            }
+        }
+    }
+
+    void search(const CsrGraph& g, uint32_t start, uint32_t end, SearchWorkspace& workspace, SearchStats& stats) const {
+        SearchContext& context = workspace.sides[0];
+        BinaryHeapFrontier& frontier = workspace.binary[0];
+        context.begin(nodeCount());
+        frontier.begin(nodeCount());
+        context.update(start, 0, LocationTable::npos);
+        frontier.push(0, 0, start);
+        uint32_t first = region[start], last = region[end];
+        auto relax = [&](uint32_t from, int dist, uint32_t to, int weight) {
+            ++stats.edgesRelaxed;
+            int candidate = addDistance(dist, weight);
+            if (candidate < context.distance(to)) {
+                context.update(to, candidate, from);
+                frontier.push(candidate, candidate, to);
+            }
+        };
+        while (!frontier.empty()) {
+            FrontierEntry entry = frontier.pop();
+            uint32_t u = entry.node;
+            if (entry.distance > context.distance(u)) continue;
+            ++stats.nodesSettled;
+            if (u == end) return;
+            bool open = region[u] == first || region[u] == last;
+            for (uint32_t e = g.edgeBegin(u); e < g.edgeEnd(u); ++e) {
+                if (open || region[g.target(e)] != region[u]) relax(u, entry.distance, g.target(e), g.weight(e));
+            }
+            if (open) continue;
+            for (uint32_t s = shortcutOffsets[u]; s < shortcutOffsets[u + 1]; ++s) {
+                relax(u, entry.distance, shortcutTargets[s], shortcutWeights[s]);
+            }
+        }
+    }
+};
+
+
+// A staged weight change on the two-way edge from <-> to; oldWeight is INT_MAX for a new edge.
+struct EdgeChange {
+    uint32_t from;
+    uint32_t to;
+    int oldWeight;
+    int newWeight;
+};
+
+
+// Dense row-major sources x targets table; INT_MAX marks an unreachable pair.
+struct DistanceMatrix {
+    uint32_t rows = 0;
+    uint32_t cols = 0;
+    vector<int> values;
+
+    int at(uint32_t row, uint32_t col) const { return values[static_cast<size_t>(row) * cols + col]; }
+};
+
+
+// One-to-all shortest-path tree from a single source; answers any target by walking predecessors.
+struct ShortestPathTree {
+    uint32_t source = LocationTable::npos;
+    vector<int> distances;
+    vector<uint32_t> predecessors;
+
+    // Nodes added after the tree was built are simply unreachable from it.
+    int distanceTo(uint32_t node) const {
+        return node < distances.size() ? distances[node] : INT_MAX;
+    }
+
+    uint32_t predecessorOf(uint32_t node) const {
+        return node < predecessors.size() ? predecessors[node] : LocationTable::npos;
+    }
+
+    vector<uint32_t> pathTo(uint32_t node) const {
+        if (distanceTo(node) == INT_MAX) return {};
+        vector<uint32_t> path;
+        for (uint32_t current = node; current != LocationTable::npos; current = predecessors[current]) {
+            path.push_back(current);
+        }
+        reverse(path.begin(), path.end());
+        return path;
+    }
+};
+
+
+// labelSetting result policy that fills a ShortestPathTree's arrays in place. Raw pointers, so
+// frontier pushes (which may allocate) do not force a reload of the vectors' data.
+struct TreeLabels {
+    ShortestPathTree& tree;
+    int* distances = nullptr;
+    uint32_t* predecessors = nullptr;
+
+    void begin(uint32_t nodeCount) {
+        tree.distances.assign(nodeCount, INT_MAX);
+        tree.predecessors.assign(nodeCount, LocationTable::npos);
+        distances = tree.distances.data();
+        predecessors = tree.predecessors.data();
+    }
+    int distance(uint32_t node) const { return distances[node]; }
+    void update(uint32_t node, int distance, uint32_t predecessor) {
+        distances[node] = distance;
+        predecessors[node] = predecessor;
+    }
+};
+
+
+// Outcome of a core operation. The core never prints; the menu and batch layers turn these into text.
+enum class Status {
+    Ok,
+    AlreadyExists,
+    UnknownLocation,
+    InvalidDistance,
+    QueueFull,
+    QueueEmpty,
+    NoCompletedDeliveries,
+    OrderNotFound,
+    DepotMissing,
+    NetworkNotEmpty,
+    FileError,
+    InvalidFile,
+    OrdersNotEmpty,
+    CourierNotFound,
+    RouteNotFound,
+    InvalidProfile,
+    OrderIdsExhausted,
+};
+
+
+const char* statusName(Status status) {
+    switch (status) {
+        case Status::Ok: return "ok";
+        case Status::AlreadyExists: return "already_exists";
+        case Status::UnknownLocation: return "unknown_location";
+        case Status::InvalidDistance: return "invalid_distance";
+        case Status::QueueFull: return "queue_full";
+        case Status::QueueEmpty: return "queue_empty";
+        case Status::NoCompletedDeliveries: return "no_completed_deliveries";
+        case Status::OrderNotFound: return "order_not_found";
+        case Status::DepotMissing: return "depot_missing";
+        case Status::NetworkNotEmpty: return "network_not_empty";
+        case Status::FileError: return "file_error";
+        case Status::InvalidFile: return "invalid_file";
+        case Status::OrdersNotEmpty: return "orders_not_empty";
+        case Status::CourierNotFound: return "courier_not_found";
+        case Status::RouteNotFound: return "route_not_found";
+        case Status::InvalidProfile: return "invalid_profile";
+        case Status::OrderIdsExhausted: return "order_ids_exhausted";
+    }
+    return "unknown";
+}
+
+
+// Result of placing, processing, reverting or looking up an order; order is only set on Ok.
+struct OrderResult {
+    Status status = Status::Ok;
+    Order order = {};
+};
+
+
+// Couriers are numbered from 1 and always stand on a location of the graph.
+struct Courier {
+    int id = 0;
+    uint32_t location = UINT32_MAX;
+    bool available = true;
+};
+
+struct CourierResult {
+    Status status = Status::Ok;
+    Courier courier;
+};
+
+struct CourierDistance {
+    int courierId;
+    int distance;
+};
+
+
+// Result of loading, saving or importing a network file.
+struct NetworkFileResult {
+    Status status = Status::Ok;
+    string detail;                 // why a file could not be opened, for FileError
+    uint32_t locations = 0;
+    uint32_t directedEdges = 0;
+    size_t routesImported = 0;
+    size_t malformedLines = 0;
+    size_t firstMalformedLine = 0;
+};
+
+
+struct JournalResult {
+    Status status = Status::Ok;
+    string detail;               // what went wrong, for FileError and InvalidFile
+    size_t records = 0;          // valid records replayed
+    size_t discardedBytes = 0;   // torn or corrupt tail dropped after a crash
+    size_t pendingOrders = 0;
+    size_t completedDeliveries = 0;
+};
+
+
+struct SystemSummary {
+    size_t pendingOrders = 0;
+    size_t completedDeliveries = 0;
+    int nextOrderId = 0;
+    vector<string> locationNames;  // sorted
+};
+
+
+// Result of optimizeDeliveryRoute and the dispatchers: the agent leg, from the assigned courier
+// or from the Depot when there are no couriers, and the delivery leg.
+struct DeliveryRoute {
+    int orderId = 0;
+    Status status = Status::OrderNotFound;
+    int courierId = 0;  // 0 when the agent leg starts at the Depot
+    int agentDistance = INT_MAX;
+    vector<uint32_t> agentPath;
+    int deliveryDistance = INT_MAX;
+    vector<uint32_t> deliveryPath;
+
+    long long totalDistance() const {
+        return (agentDistance == INT_MAX || deliveryDistance == INT_MAX) ? -1 : static_cast<long long>(agentDistance) + deliveryDistance;
+    }
+};
+
+
+// Grouping limits for planTours. Orders only share a courier when they were placed within
+// windowOrders of each other in the queue and their restaurants are pickupRadius km apart or less.
+struct TourOptions {
+    size_t maxOrdersPerTour = 4;
+    size_t windowOrders = 32;
+    int pickupRadius = 5;
+};
+
+struct TourStop {
+    int orderId;
+    uint32_t location;
+    bool pickup;
+};
+
+// One courier leaving the Depot and ending at its last drop-off.
+struct CourierTour {
+    vector<TourStop> stops;
+    int distance = 0;
+    int separateDistance = 0;  // the same orders as independent Depot trips
+};
+
+struct TourPlan {
+    Status status = Status::Ok;
+    vector<CourierTour> tours;
+    vector<int> unroutableOrderIds;
+    long long distance = 0;
+    long long separateDistance = 0;
+};
+
+
+// Limits for dispatchPendingOrders. Orders are taken in scheduler order; the rest wait for the next round.
+struct DispatchOptions {
+    size_t maxOrders = 4096;
+    size_t candidates = 32;          // nearest couriers offered each restaurant; 0 offers them all
+    int maxAgentDistance = INT_MAX;  // couriers further than this from a restaurant are not offered it
+};
+
+struct DispatchResult {
+    vector<DeliveryRoute> routes;  // one per dispatched order, in queue order
+    size_t requeuedOrders = 0;
+    size_t rejectedOrders = 0;     // no route to the destination, or no room to requeue
+    size_t idleCouriers = 0;
+    long long distance = 0;        // agent plus delivery legs over all routes
+};
+
+
+// Sizing for runOrderPipeline. Every stage queue holds at most queueCapacity orders.
+struct PipelineOptions {
+    unsigned threads = 0;       // executor threads; 0 uses one per hardware thread
+    size_t queueCapacity = 256;
+    unsigned routeWorkers = 4;  // orders routed concurrently
+};
+
+struct PipelineResult {
+    Status status = Status::Ok;
+    vector<DeliveryRoute> routes;  // delivered orders, in completion order
+    size_t rejectedOrders = 0;     // failed intake or had no route to the destination
+    size_t requeuedOrders = 0;     // no courier was available
+    size_t stalls = 0;             // times a stage waited on a full downstream queue
+};
+
+
+// Pickup-and-delivery sequencing over a distance matrix: cheapest feasible insertion, then
+// Or-opt and 2-opt moves until neither finds a gain. Tours are open paths from the depot and
+// every pickup has to precede its drop-off. Stops refer to matrix indices.
+class TourSequencer {
+public:
+    struct Stop {
+        uint32_t slot;   // order within the tour being built
+        uint32_t point;  // matrix index
+        bool pickup;
+    };
+
+    TourSequencer(const DistanceMatrix& matrix, uint32_t depot) : matrix(matrix), depot(depot) {}
+
+    long long cost(const vector<Stop>& tour) const {
+        long long total = 0;
+        uint32_t previous = depot;
+        for (const Stop& stop : tour) {
+            total += matrix.at(previous, stop.point);
+            previous = stop.point;
+        }
+        return total;
+    }
+
+    // Cheapest extra distance for adding pickup and drop-off; LLONG_MAX if nothing fits.
+    long long bestInsertion(const vector<Stop>& tour, const Stop& pickup, const Stop& drop,
+                            size_t& pickupGap, size_t& dropGap) const {
+        long long best = LLONG_MAX;
+        for (size_t a = 0; a <= tour.size(); ++a) {
+            long long pickupDelta = gapDelta(tour, a, pickup.point);
+            for (size_t b = a; b <= tour.size(); ++b) {
+                long long delta;
+                if (b == a) {
+                    delta = matrix.at(pointBefore(tour, a), pickup.point) + matrix.at(pickup.point, drop.point);
+                    if (a < tour.size()) delta += matrix.at(drop.point, tour[a].point) - matrix.at(pointBefore(tour, a), tour[a].point);
+                } else {
+                    delta = pickupDelta + gapDelta(tour, b, drop.point);
+                }
+                if (delta < best) {
+                    best = delta;
+                    pickupGap = a;
+                    dropGap = b;
+                }
+            }
+        }
+        return best;
+    }
+
+    static void insert(vector<Stop>& tour, const Stop& pickup, const Stop& drop, size_t pickupGap, size_t dropGap) {
+        tour.insert(tour.begin() + dropGap, drop);
+        tour.insert(tour.begin() + pickupGap, pickup);
+    }
+
+    // Local search until a full pass over both neighbourhoods finds nothing.
+    void improve(vector<Stop>& tour) {
+        long long current = cost(tour);
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            // Or-opt: move a run of one to three stops elsewhere.
+            for (size_t length = 1; length <= 3; ++length) {
+                for (size_t from = 0; from + length <= tour.size(); ++from) {
+                    for (size_t to = 0; to + length <= tour.size(); ++to) {
+                        if (to == from) continue;
+                        candidate = tour;
+                        vector<Stop> run(candidate.begin() + from, candidate.begin() + from + length);
+                        candidate.erase(candidate.begin() + from, candidate.begin() + from + length);
+                        candidate.insert(candidate.begin() + to, run.begin(), run.end());
+                        if (accept(tour, current)) improved = true;
+                    }
+                }
+            }
+            // 2-opt: reverse a segment.
+            for (size_t i = 0; i + 1 < tour.size(); ++i) {
+                for (size_t j = i + 1; j < tour.size(); ++j) {
+                    candidate = tour;
+                    reverse(candidate.begin() + i, candidate.begin() + j + 1);
+                    if (accept(tour, current)) improved = true;
+                }
+            }
+        }
+    }
+
+private:
+    const DistanceMatrix& matrix;
+    uint32_t depot;
+    vector<Stop> candidate;
+    vector<char> picked;
+
+    uint32_t pointBefore(const vector<Stop>& tour, size_t gap) const { return gap == 0 ? depot : tour[gap - 1].point; }
+
+    long long gapDelta(const vector<Stop>& tour, size_t gap, uint32_t point) const {
+        uint32_t previous = pointBefore(tour, gap);
+        long long delta = matrix.at(previous, point);
+        if (gap < tour.size()) delta += matrix.at(point, tour[gap].point) - matrix.at(previous, tour[gap].point);
+        return delta;
+    }
+
+    bool feasible(const vector<Stop>& tour) {
+        picked.assign(tour.size(), 0);
+        for (const Stop& stop : tour) {
+            if (stop.pickup) picked[stop.slot] = 1;
+            else if (!picked[stop.slot]) return false;
+        }
+        return true;
+    }
+
+    // Takes candidate over tour when it is feasible and strictly shorter.
+    bool accept(vector<Stop>& tour, long long& current) {
+        long long length = cost(candidate);
+        if (length >= current || !feasible(candidate)) return false;
+        tour.swap(candidate);
+        current = length;
+        return true;
+    }
+};
+
+
+// Bounded (source, target) -> (distance, path) cache for hot pairs. Keys hash to one of 16
+// shards, each an LRU list under its own mutex, so parallel lookups only contend when they
+// land on the same shard. Sizes are counted in bytes, path included. invalidate() bumps a
+// generation instead of walking the shards: older entries read as misses and are dropped
+// when next touched, and inserts computed before the bump are discarded.
+class RouteCache {
+public:
+    explicit RouteCache(size_t capacityBytes = 16 << 20) { setCapacity(capacityBytes); }
+
+    // Not safe against concurrent lookups; evicts down to the new budget right away.
+    void setCapacity(size_t capacityBytes) {
+        shardBudget = capacityBytes / shardCount;
+        for (Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            evict(shard);
+        }
+    }
+
+    size_t capacity() const { return shardBudget * shardCount; }
+
+    size_t bytes() const {
+        size_t total = 0;
+        for (const Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            total += shard.bytes;
+        }
+        return total;
+    }
+
+    uint64_t generation() const { return currentGeneration.load(memory_order_acquire); }
+    void invalidate() { currentGeneration.fetch_add(1, memory_order_acq_rel); }
+
+    // On a hit copies the route out and marks it most recently used.
+    bool find(uint32_t from, uint32_t to, int& distance, vector<uint32_t>& path) {
+        uint64_t key = static_cast<uint64_t>(from) << 32 | to;
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) return false;
+        if (it->second->generation != generation()) {
+            erase(shard, it->second);
+            return false;
+        }
+        shard.recent.splice(shard.recent.begin(), shard.recent, it->second);
+        distance = it->second->distance;
+        path = it->second->path;
+        return true;
+    }
+
+    // generation is the value read before the route was computed.
+    void insert(uint32_t from, uint32_t to, uint64_t generation, int distance, const vector<uint32_t>& path) {
+        size_t entryBytes = sizeof(Entry) + path.size() * sizeof(uint32_t) + indexOverhead;
+        if (entryBytes > shardBudget) return;
+        uint64_t key = static_cast<uint64_t>(from) << 32 | to;
+        Shard& shard = shardFor(key);
+        lock_guard<mutex> guard(shard.lock);
+        if (generation != this->generation()) return;
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) erase(shard, it->second);
+        shard.recent.push_front(Entry{key, generation, distance, path, entryBytes});
+        shard.index.emplace(key, shard.recent.begin());
+        shard.bytes += entryBytes;
+        evict(shard);
+    }
+
+private:
+    static constexpr size_t shardCount = 16;
+    static constexpr size_t indexOverhead = 48;  // list and hash nodes, roughly
+
+    struct Entry {
+        uint64_t key;
+        uint64_t generation;
+        int distance;
+        vector<uint32_t> path;
+        size_t bytes;
+    };
+
+    struct alignas(64) Shard {
+        mutable mutex lock;
+        list<Entry> recent;  // most recently used first
+        unordered_map<uint64_t, list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    // The top four bits of a Fibonacci hash pick the shard.
+    Shard& shardFor(uint64_t key) { return shards[(key * 0x9E3779B97F4A7C15ull) >> 60]; }
+
+    void erase(Shard& shard, list<Entry>::iterator entry) {
+        shard.bytes -= entry->bytes;
+        shard.index.erase(entry->key);
+        shard.recent.erase(entry);
+    }
+
+    void evict(Shard& shard) {
+        while (shard.bytes > shardBudget) erase(shard, prev(shard.recent.end()));
+    }
+
+    Shard shards[shardCount];
+    size_t shardBudget = 0;
+    atomic<uint64_t> currentGeneration{0};
+};
+
+
+#if FD_COROUTINES
+// Run queue shared by the order pipeline's stages: a fixed set of threads resuming ready
+// coroutines in FIFO order. A stage waiting on a queue is suspended, not parked on a thread,
+// so a few threads serve any number of stages.
+class PipelineExecutor {
+public:
+    explicit PipelineExecutor(unsigned threadCount) {
+        for (unsigned i = 0; i < max(1u, threadCount); ++i) threads.emplace_back([this] { workerLoop(); });
+    }
+
+    PipelineExecutor(const PipelineExecutor&) = delete;
+    PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+    ~PipelineExecutor() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) worker.join();
+    }
+
+    void schedule(coroutine_handle<> handle) {
+        {
+            lock_guard<mutex> guard(lock);
+            ready.push_back(handle);
+        }
+        wake.notify_one();
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            coroutine_handle<> handle;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || !ready.empty(); });
+                if (ready.empty()) return;
+                handle = ready.front();
+                ready.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    mutex lock;
+    condition_variable wake;
+    deque<coroutine_handle<>> ready;
+    bool stopping = false;
+    vector<thread> threads;
+};
+
+
+// Fire-and-forget pipeline stage: created suspended, handed to PipelineExecutor::schedule,
+// and destroyed when its body returns.
+struct StageTask {
+    struct promise_type {
+        StageTask get_return_object() { return StageTask{coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+
+    coroutine_handle<promise_type> handle;
+};
+
+
+// Bounded queue between two pipeline stages. co_await push() suspends the producer while the
+// queue is full, which is the pipeline's backpressure, and co_await pop() suspends the consumer
+// while it is empty; after close() consumers drain what is left and then get nullopt. Waiters
+// are resumed on the executor, never inline, so no stage runs inside another's call stack.
+template <typename T>
+class StageQueue {
+public:
+    StageQueue(PipelineExecutor& executor, size_t capacity) : executor(executor), capacity(max<size_t>(capacity, 1)) {}
+
+    struct PushAwaiter {
+        StageQueue& queue;
+        T value;
+        coroutine_handle<> waiter;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(coroutine_handle<> handle) {
+            lock_guard<mutex> guard(queue.lock);
+            if (!queue.poppers.empty()) {
+                PopAwaiter* popper = queue.poppers.front();
+                queue.poppers.pop_front();
+                popper->value = move(value);
+                queue.executor.schedule(popper->waiter);
+                return false;
+            }
+            if (queue.items.size() < queue.capacity) {
+                queue.items.push_back(move(value));
+                return false;
+            }
+            waiter = handle;
+            queue.pushers.push_back(this);
+            ++queue.stalls;
+            return true;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct PopAwaiter {
+        StageQueue& queue;
+        optional<T> value;
+        coroutine_handle<> waiter;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(coroutine_handle<> handle) {
+            lock_guard<mutex> guard(queue.lock);
+            if (!queue.items.empty()) {
+                value = move(queue.items.front());
+                queue.items.pop_front();
+                if (!queue.pushers.empty()) {
+                    PushAwaiter* pusher = queue.pushers.front();
+                    queue.pushers.pop_front();
+                    queue.items.push_back(move(pusher->value));
+                    queue.executor.schedule(pusher->waiter);
+                }
+                return false;
+            }
+            if (queue.closed) return false;
+            waiter = handle;
+            queue.poppers.push_back(this);
+            return true;
+        }
+        optional<T> await_resume() { return move(value); }
+    };
+
+    PushAwaiter push(T value) { return PushAwaiter{*this, move(value), nullptr}; }
+    PopAwaiter pop() { return PopAwaiter{*this, nullopt, nullptr}; }
+
+    // No pushes may follow.
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        for (PopAwaiter* popper : poppers) executor.schedule(popper->waiter);
+        poppers.clear();
+    }
+
+    size_t stallCount() const {
+        lock_guard<mutex> guard(lock);
+        return stalls;
+    }
+
+private:
+    PipelineExecutor& executor;
+    size_t capacity;
+    mutable mutex lock;
+    deque<T> items;
+    deque<PushAwaiter*> pushers;
+    deque<PopAwaiter*> poppers;
+    bool closed = false;
+    size_t stalls = 0;
+};
+#endif
+
+
+// Fixed set of worker threads; the calling thread joins in as worker 0.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threadCount) {
+        for (unsigned worker = 1; worker < max(1u, threadCount); ++worker) {
+            threads.emplace_back([this, worker] { workerLoop(worker); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(threads.size()) + 1; }
+
+    // Runs task(index, worker) for every index in [0, count) and returns once all have finished.
+    void parallelFor(size_t count, const function<void(size_t, unsigned)>& task) {
+        if (count == 0) return;
+        {
+            lock_guard<mutex> guard(lock);
+            currentTask = &task;
+            taskCount = count;
+            nextIndex.store(0);
+            activeWorkers = static_cast<unsigned>(threads.size());
+            ++generation;
+        }
+        wake.notify_all();
+        runTasks(0);
+
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return activeWorkers == 0; });
+        currentTask = nullptr;
+    }
+
+private:
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    const function<void(size_t, unsigned)>* currentTask = nullptr;
+    size_t taskCount = 0;
+    atomic<size_t> nextIndex{0};
+    unsigned activeWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void runTasks(unsigned worker) {
+        for (size_t index = nextIndex.fetch_add(1); index < taskCount; index = nextIndex.fetch_add(1)) {
+            (*currentTask)(index, worker);
+        }
+    }
+
+    void workerLoop(unsigned worker) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runTasks(worker);
+            {
+                lock_guard<mutex> guard(lock);
+                --activeWorkers;
+            }
+            finished.notify_one();
+        }
+    }
+};
+
+
+// Minimum-cost assignment of rows to columns: the Hungarian method in its shortest augmenting
+// path form, O(r^2 c) for r rows and c >= r columns (a taller matrix is solved transposed). An
+// INT_MAX entry costs more than all real entries together, so as many rows as possible are
+// matched before any distance is traded.
+class AssignmentSolver {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // costs is rows x cols, row-major. Returns each row's column, or npos where it stays unmatched.
+    static vector<uint32_t> solve(const vector<int>& costs, uint32_t rows, uint32_t cols) {
+        vector<uint32_t> match(rows, npos);
+        bool transposed = rows > cols;
+        uint32_t r = transposed ? cols : rows, c = transposed ? rows : cols;
+        if (r == 0) return match;
+        vector<int> flipped;
+        if (transposed) {
+            flipped.resize(costs.size());
+            for (uint32_t i = 0; i < rows; ++i) {
+                for (uint32_t j = 0; j < cols; ++j) flipped[static_cast<size_t>(j) * rows + i] = costs[static_cast<size_t>(i) * cols + j];
+            }
+        }
+        const vector<int>& matrix = transposed ? flipped : costs;
+        long long largest = 0;
+        for (int cost : costs) {
+            if (cost != INT_MAX) largest = max<long long>(largest, cost);
+        }
+        long long blocked = largest * r + 1;
+
+        // One-based, with column 0 standing for the row being inserted.
+        const long long infinity = LLONG_MAX / 4;
+        vector<long long> rowPotential(r + 1, 0), columnPotential(c + 1, 0), slack(c + 1);
+        vector<uint32_t> rowOf(c + 1, 0), previous(c + 1, 0);
+        vector<char> visited(c + 1);
+        for (uint32_t inserted = 1; inserted <= r; ++inserted) {
+            rowOf[0] = inserted;
+            uint32_t column = 0;
+            fill(slack.begin(), slack.end(), infinity);
+            fill(visited.begin(), visited.end(), 0);
+            do {
+                visited[column] = 1;
+                uint32_t row = rowOf[column], next = 0;
+                long long delta = infinity;
+                const int* rowCosts = matrix.data() + static_cast<size_t>(row - 1) * c;
+                for (uint32_t j = 1; j <= c; ++j) {
+                    if (visited[j]) continue;
+                    long long reduced = (rowCosts[j - 1] == INT_MAX ? blocked : rowCosts[j - 1]) - rowPotential[row] - columnPotential[j];
+                    if (reduced < slack[j]) {
+                        slack[j] = reduced;
+                        previous[j] = column;
+                    }
+                    if (slack[j] < delta) {
+                        delta = slack[j];
+                        next = j;
+                    }
+                }
+                for (uint32_t j = 0; j <= c; ++j) {
+                    if (visited[j]) {
+                        rowPotential[rowOf[j]] += delta;
+                        columnPotential[j] -= delta;
+                    } else {
+                        slack[j] -= delta;
+                    }
+                }
+                column = next;
+            } while (rowOf[column] != 0);
+            // Flip the alternating path back to the inserted row.
+            while (column) {
+                uint32_t before = previous[column];
+                rowOf[column] = rowOf[before];
+                column = before;
+            }
+        }
+
+        for (uint32_t j = 1; j <= c; ++j) {
+            if (!rowOf[j] || matrix[static_cast<size_t>(rowOf[j] - 1) * c + j - 1] == INT_MAX) continue;
+            if (transposed) match[j - 1] = rowOf[j] - 1;
+            else match[rowOf[j] - 1] = j - 1;
+        }
+        return match;
+    }
+};
+
+
+// Bounded lock-free multi-producer/multi-consumer FIFO (Vyukov ring). Each cell's sequence
+// number tells producers and consumers whether it is free or filled for the current lap.
+template <typename T>
+class MpmcQueue {
+    static_assert(is_trivially_copyable<T>::value, "MpmcQueue cells are copied with atomic loads");
+
+public:
+    explicit MpmcQueue(size_t requestedCapacity) {
+        size_t capacity = 2;
+        while (capacity < requestedCapacity) capacity <<= 1;
+        mask = capacity - 1;
+        cells.reset(new Cell[capacity]);
+        for (size_t i = 0; i < capacity; ++i) cells[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    bool tryPush(const T& value) {
+        size_t position = enqueuePosition.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (lap == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    cell.value.store(value, memory_order_relaxed);
+                    cell.sequence.store(position + 1, memory_order_release);
+                    return true;
+                }
+            } else if (lap < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t position = dequeuePosition.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (lap == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    value = cell.value.load(memory_order_relaxed);
+                    cell.sequence.store(position + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (lap < 0) {
+                return false;
+            } else {
+                position = dequeuePosition.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate while other threads are pushing or popping.
+    size_t size() const {
+        size_t head = dequeuePosition.load(memory_order_acquire);
+        size_t tail = enqueuePosition.load(memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // Visits the filled cells between head and tail at the time of the call, oldest first, in
+    // place. A cell consumed or refilled mid-scan is skipped rather than read torn.
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        size_t head = dequeuePosition.load(memory_order_acquire);
+        size_t tail = enqueuePosition.load(memory_order_acquire);
+        for (size_t position = head; position < tail; ++position) {
+            const Cell& cell = cells[position & mask];
+            if (cell.sequence.load(memory_order_acquire) != position + 1) continue;
+            T value = cell.value.load(memory_order_acquire);
+            if (cell.sequence.load(memory_order_relaxed) == position + 1) visit(value);
+        }
+    }
+
+    vector<T> snapshot() const {
+        vector<T> items;
+        forEach([&](const T& value) { items.push_back(value); });
+        return items;
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        atomic<T> value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) atomic<size_t> enqueuePosition{0};
+    alignas(64) atomic<size_t> dequeuePosition{0};
+};
+
+
+enum class SchedulingPolicy {
+    Fifo,
+    Priority
+};
+
+// Priority keys are latest-dispatch times in scheduler seconds: the deadline, minus the estimated
+// travel time, minus a bonus for the order's price. Both credits are capped, which is what ages
+// waiting orders: an order is always served before any order placed more than
+// maxTravelCredit + maxPriceBonus seconds after its key, so nothing starves.
+struct SchedulerOptions {
+    SchedulingPolicy policy = SchedulingPolicy::Fifo;
+    uint32_t defaultSlaSeconds = 45 * 60;
+    int secondsPerKm = 120;
+    int secondsPerDollar = 30;
+    int maxPriceBonus = 10 * 60;
+    int maxTravelCredit = 30 * 60;
+};
+
+
+// Pending-order intake with two interchangeable disciplines. FIFO keeps the lock-free ring;
+// Priority is an ordered set under a mutex, giving O(log n) push and pop and in-order
+// iteration without a copy. Ties on the key fall back to arrival order.
+class OrderScheduler {
+public:
+    explicit OrderScheduler(size_t capacity) : fifo(capacity), limit(fifo.capacity()) {}
+
+    SchedulingPolicy policy() const { return currentPolicy; }
+
+    // Not safe while other threads push or pop; the caller re-queues whatever was pending.
+    void setPolicy(SchedulingPolicy policy) { currentPolicy = policy; }
+
+    bool push(uint32_t handle, long long key) {
+        if (currentPolicy == SchedulingPolicy::Fifo) return fifo.tryPush(handle);
+        lock_guard<mutex> guard(rankedLock);
+        if (ranked.size() >= limit) return false;
+        ranked.insert(Entry{key, arrivals++, handle});
+        return true;
+    }
+
+    bool pop(uint32_t& handle) {
+        if (currentPolicy == SchedulingPolicy::Fifo) return fifo.tryPop(handle);
+        lock_guard<mutex> guard(rankedLock);
+        if (ranked.empty()) return false;
+        handle = ranked.begin()->handle;
+        ranked.erase(ranked.begin());
+        return true;
+    }
+
+    size_t size() const {
+        if (currentPolicy == SchedulingPolicy::Fifo) return fifo.size();
+        lock_guard<mutex> guard(rankedLock);
+        return ranked.size();
+    }
+
+    // Visits pending handles in the order pop would return them.
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        if (currentPolicy == SchedulingPolicy::Fifo) {
+            fifo.forEach(visit);
+            return;
+        }
+        lock_guard<mutex> guard(rankedLock);
+        for (const Entry& entry : ranked) visit(entry.handle);
+    }
+
+private:
+    struct Entry {
+        long long key;
+        uint64_t arrival;
+        uint32_t handle;
+
+        bool operator<(const Entry& other) const {
+            return key != other.key ? key < other.key : arrival < other.arrival;
+        }
+    };
+
+    MpmcQueue<uint32_t> fifo;
+    size_t limit;
+    SchedulingPolicy currentPolicy = SchedulingPolicy::Fifo;
+    mutable mutex rankedLock;
+    set<Entry> ranked;
+    uint64_t arrivals = 0;
+};
+
+
+// Append-only chunked order storage. Slots never move, so a handle stays valid while other
+// threads append. Slot i holds the order with id firstOrderId + i, which makes the id lookup
+// a subtraction instead of a map probe. Orders that will never be looked at again are retired,
+// and a chunk is freed once all of its slots are; find() then reports those ids as unknown.
+class OrderSlab {
+public:
+    static constexpr int firstOrderId = 1001;
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    OrderSlab() {
+        for (auto& chunk : chunks) chunk.store(nullptr, memory_order_relaxed);
+    }
+
+    OrderSlab(const OrderSlab&) = delete;
+    OrderSlab& operator=(const OrderSlab&) = delete;
+
+    ~OrderSlab() {
+        for (auto& chunk : chunks) delete chunk.load(memory_order_relaxed);
+    }
+
+    // Reserves the next slot (and with it the next order id); the order is invisible until published.
+    // Returns npos once all capacity() slots have been handed out.
+    uint32_t allocate() {
+        uint32_t handle = nextSlot.load(memory_order_relaxed);
+        do {
+            if (handle >= capacity()) return npos;
+        } while (!nextSlot.compare_exchange_weak(handle, handle + 1, memory_order_relaxed));
+        ensureChunk(handle);
+        return handle;
+    }
+
+    static constexpr uint32_t capacity() { return maxChunks << chunkBits; }
+
+    // Journal replay: puts an order back into its original slot.
+    void restore(uint32_t handle, const Order& order) {
+        reserveThrough(handle + 1);
+        ensureChunk(handle);
+        publish(handle, order);
+    }
+
+    // Ids below idFor(next) are never handed out again.
+    void reserveThrough(uint32_t next) {
+        uint32_t current = nextSlot.load(memory_order_relaxed);
+        while (current < next && !nextSlot.compare_exchange_weak(current, next, memory_order_relaxed)) {}
+    }
+
+    bool published(uint32_t handle) const {
+        Chunk* chunk = chunks[handle >> chunkBits].load(memory_order_acquire);
+        return chunk && chunk->ready[handle & chunkMask].load(memory_order_acquire);
+    }
+
+    // Must be called at most once per allocated slot, when nothing refers to the order any more.
+    // The slot stops being found before its chunk can go away.
+    void retire(uint32_t handle) {
+        atomic<Chunk*>& slot = chunks[handle >> chunkBits];
+        Chunk* chunk = slot.load(memory_order_acquire);
+        if (!chunk) return;
+        chunk->ready[handle & chunkMask].store(0, memory_order_release);
+        if (chunk->live.fetch_sub(1, memory_order_acq_rel) != 1) return;
+        slot.store(nullptr, memory_order_release);
+        delete chunk;
+    }
+
+    void publish(uint32_t handle, const Order& order) {
+        Chunk* chunk = chunks[handle >> chunkBits].load(memory_order_acquire);
+        chunk->orders[handle & chunkMask] = order;
+        chunk->ready[handle & chunkMask].store(1, memory_order_release);
+    }
+
+    // Only valid for handles that have been published.
+    const Order& at(uint32_t handle) const {
+        return chunks[handle >> chunkBits].load(memory_order_acquire)->orders[handle & chunkMask];
+    }
+
+    bool find(int id, uint32_t& handle) const {
+        if (id < firstOrderId) return false;
+        uint32_t candidate = static_cast<uint32_t>(id - firstOrderId);
+        if (candidate >= nextSlot.load(memory_order_acquire)) return false;
+        Chunk* chunk = chunks[candidate >> chunkBits].load(memory_order_acquire);
+        if (!chunk || !chunk->ready[candidate & chunkMask].load(memory_order_acquire)) return false;
+        handle = candidate;
+        return true;
+    }
+
+    static int idFor(uint32_t handle) { return firstOrderId + static_cast<int>(handle); }
+
+    int nextId() const { return idFor(nextSlot.load(memory_order_relaxed)); }
+
+private:
+    static constexpr uint32_t chunkBits = 14;
+    static constexpr uint32_t chunkSize = 1u << chunkBits;
+    static constexpr uint32_t chunkMask = chunkSize - 1;
+    static constexpr uint32_t maxChunks = 1u << 14;
+
+    struct Chunk {
+        Order orders[chunkSize];
+        atomic<uint8_t> ready[chunkSize] = {};
+        atomic<uint32_t> live{chunkSize};
+    };
+
+    void ensureChunk(uint32_t handle) {
+        atomic<Chunk*>& slot = chunks[handle >> chunkBits];
+        if (!slot.load(memory_order_acquire)) {
+            Chunk* fresh = new Chunk();
+            Chunk* expected = nullptr;
+            if (!slot.compare_exchange_strong(expected, fresh, memory_order_acq_rel)) delete fresh;
+        }
+    }
+
+    atomic<Chunk*> chunks[maxChunks];
+    atomic<uint32_t> nextSlot{0};
+};
+
+
+void writeJsonString(string& out, string_view text) {
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            const char* hex = "0123456789abcdef";
+            out += "\\u00";
+            out += hex[(c >> 4) & 0xf];
+            out += hex[c & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+
+void writeJsonDistance(string& out, long long distance) {
+    out += distance == INT_MAX || distance < 0 ? "null" : to_string(distance);
+}
+
+
+void writeJsonPath(string& out, const vector<string>& path) {
+    out += '[';
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (i) out += ',';
+        writeJsonString(out, path[i]);
+    }
+    out += ']';
+}
+
+
+enum class MetricCounter {
+    Searches,
+    NodesSettled,
+    EdgesRelaxed,
+    OrdersPlaced,
+    OrdersRejected,
+    OrdersProcessed,
+    OrdersReverted,
+    RoutesOptimized,
+    TreeCacheHits,
+    TreeCacheMisses,
+    RouteCacheHits,
+    RouteCacheMisses,
+    TreesRepaired,
+    TreeNodesRepaired,  // nodes settled by repair passes, detached subtrees included
+    ToursPlanned,
+    OrdersDispatched,
+    Count
+};
+
+enum class MetricTimer { FindShortestPath, OptimizeDeliveryRoute, Count };
+
+// Largest value ever observed, aggregated with max.
+enum class MetricHighWater { PendingOrders, CompletedDeliveries, Count };
+
+
+// Power-of-two latency buckets: bucket b counts calls that took under 2^b microseconds, and
+// the last bucket also takes everything slower.
+struct LatencyHistogram {
+    static constexpr int bucketCount = 22;
+
+    uint64_t buckets[bucketCount] = {};
+    uint64_t count = 0;
+    double sumSeconds = 0;
+
+    static int bucketFor(uint64_t nanos) {
+        uint64_t micros = nanos / 1000;
+        int bucket = 0;
+        while (bucket < bucketCount - 1 && micros >= (uint64_t(1) << bucket)) ++bucket;
+        return bucket;
+    }
+
+    static double upperBoundSeconds(int bucket) { return static_cast<double>(uint64_t(1) << bucket) * 1e-6; }
+
+    // Upper bound of the bucket holding the q-th quantile.
+    double quantileSeconds(double q) const {
+        uint64_t rank = static_cast<uint64_t>(ceil(q * count)), seen = 0;
+        for (int b = 0; b < bucketCount; ++b) {
+            seen += buckets[b];
+            if (seen >= rank && seen > 0) return upperBoundSeconds(b);
+        }
+        return 0;
+    }
+};
+
+
+// One thread's counters. Only the owning thread writes, so updates are relaxed load+store
+// pairs without read-modify-write; readers sum the shards.
+struct MetricsShard {
+    atomic<uint64_t> counters[static_cast<size_t>(MetricCounter::Count)] = {};
+    atomic<uint64_t> highWater[static_cast<size_t>(MetricHighWater::Count)] = {};
+    atomic<uint64_t> latencyBuckets[static_cast<size_t>(MetricTimer::Count)][LatencyHistogram::bucketCount] = {};
+    atomic<uint64_t> latencyNanos[static_cast<size_t>(MetricTimer::Count)] = {};
+
+    static void bump(atomic<uint64_t>& value, uint64_t by) {
+        value.store(value.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+
+    void add(MetricCounter counter, uint64_t by = 1) { bump(counters[static_cast<size_t>(counter)], by); }
+
+    void raise(MetricHighWater mark, uint64_t value) {
+        atomic<uint64_t>& current = highWater[static_cast<size_t>(mark)];
+        if (value > current.load(memory_order_relaxed)) current.store(value, memory_order_relaxed);
+    }
+
+    void observe(MetricTimer timer, uint64_t nanos) {
+        size_t t = static_cast<size_t>(timer);
+        bump(latencyBuckets[t][LatencyHistogram::bucketFor(nanos)], 1);
+        bump(latencyNanos[t], nanos);
+    }
+};
+
+
+struct MetricsSnapshot {
+    uint64_t counters[static_cast<size_t>(MetricCounter::Count)] = {};
+    uint64_t highWater[static_cast<size_t>(MetricHighWater::Count)] = {};
+    LatencyHistogram latency[static_cast<size_t>(MetricTimer::Count)];
+    uint64_t pendingOrders = 0;
+    uint64_t completedDeliveries = 0;
+    uint64_t routeCacheBytes = 0;
+    double uptimeSeconds = 0;
+
+    uint64_t count(MetricCounter counter) const { return counters[static_cast<size_t>(counter)]; }
+    uint64_t peak(MetricHighWater mark) const { return highWater[static_cast<size_t>(mark)]; }
+    const LatencyHistogram& timer(MetricTimer timer) const { return latency[static_cast<size_t>(timer)]; }
+
+    double ratePerSecond(MetricCounter counter) const { return uptimeSeconds > 0 ? count(counter) / uptimeSeconds : 0; }
+
+    double treeCacheHitRate() const {
+        uint64_t lookups = count(MetricCounter::TreeCacheHits) + count(MetricCounter::TreeCacheMisses);
+        return lookups ? static_cast<double>(count(MetricCounter::TreeCacheHits)) / lookups : 0;
+    }
+
+    double routeCacheHitRate() const {
+        uint64_t lookups = count(MetricCounter::RouteCacheHits) + count(MetricCounter::RouteCacheMisses);
+        return lookups ? static_cast<double>(count(MetricCounter::RouteCacheHits)) / lookups : 0;
+    }
+};
+
+
+// Per-thread metric shards, created on a thread's first update and summed on read.
+class MetricsRegistry {
+public:
+    MetricsRegistry() : serial(nextSerial()), started(chrono::steady_clock::now()) {}
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    MetricsShard& local() {
+        // Keyed by a never-reused serial, so entries for destroyed registries are never read.
+        thread_local uint64_t cachedSerial = 0;
+        thread_local MetricsShard* cached = nullptr;
+        if (cachedSerial == serial) return *cached;
+        thread_local unordered_map<uint64_t, MetricsShard*> threadShards;
+        MetricsShard*& shard = threadShards[serial];
+        if (!shard) {
+            lock_guard<mutex> guard(lock);
+            shards.emplace_back(new MetricsShard());
+            shard = shards.back().get();
+        }
+        cachedSerial = serial;
+        cached = shard;
+        return *shard;
+    }
+
+    MetricsSnapshot snapshot() const {
+        MetricsSnapshot result;
+        result.uptimeSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        lock_guard<mutex> guard(lock);
+        for (const auto& shard : shards) {
+            for (size_t c = 0; c < static_cast<size_t>(MetricCounter::Count); ++c) {
+                result.counters[c] += shard->counters[c].load(memory_order_relaxed);
+            }
+            for (size_t m = 0; m < static_cast<size_t>(MetricHighWater::Count); ++m) {
+                result.highWater[m] = max(result.highWater[m], shard->highWater[m].load(memory_order_relaxed));
+            }
+            for (size_t t = 0; t < static_cast<size_t>(MetricTimer::Count); ++t) {
+                LatencyHistogram& histogram = result.latency[t];
+                for (int b = 0; b < LatencyHistogram::bucketCount; ++b) {
+                    uint64_t calls = shard->latencyBuckets[t][b].load(memory_order_relaxed);
+                    histogram.buckets[b] += calls;
+                    histogram.count += calls;
+                }
+                histogram.sumSeconds += shard->latencyNanos[t].load(memory_order_relaxed) * 1e-9;
+            }
+        }
+        return result;
+    }
+
+private:
+    static uint64_t nextSerial() {
+        static atomic<uint64_t> serials{0};
+        return ++serials;
+    }
+
+    uint64_t serial;
+    chrono::steady_clock::time_point started;
+    mutable mutex lock;
+    vector<unique_ptr<MetricsShard>> shards;
+};
+
+
+// Records the enclosing scope's duration into the calling thread's shard.
+class ScopedLatency {
+public:
+    ScopedLatency(MetricsRegistry& registry, MetricTimer timer)
+        : registry(registry), timer(timer), start(chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        auto nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        registry.local().observe(timer, static_cast<uint64_t>(nanos));
+    }
+
+private:
+    MetricsRegistry& registry;
+    MetricTimer timer;
+    chrono::steady_clock::time_point start;
+};
+
+
+// Prometheus text exposition format, version 0.0.4.
+void writePrometheusMetrics(ostream& out, const MetricsSnapshot& snapshot) {
+    struct CounterInfo { MetricCounter counter; const char* name; const char* help; };
+    const CounterInfo counters[] = {
+        {MetricCounter::Searches, "fd_searches_total", "Point-to-point and matrix searches run."},
+        {MetricCounter::NodesSettled, "fd_search_nodes_settled_total", "Nodes settled across all searches."},
+        {MetricCounter::EdgesRelaxed, "fd_search_edges_relaxed_total", "Edges relaxed across all searches."},
+        {MetricCounter::OrdersPlaced, "fd_orders_placed_total", "Orders accepted into the pending queue."},
+        {MetricCounter::OrdersRejected, "fd_orders_rejected_total", "Orders rejected (unknown location or full queue)."},
+        {MetricCounter::OrdersProcessed, "fd_orders_processed_total", "Orders delivered."},
+        {MetricCounter::OrdersReverted, "fd_orders_reverted_total", "Deliveries reverted to the pending queue."},
+        {MetricCounter::RoutesOptimized, "fd_routes_optimized_total", "Delivery routes planned, single and batched."},
+        {MetricCounter::TreeCacheHits, "fd_tree_cache_hits_total", "Shortest-path tree lookups served from cache."},
+        {MetricCounter::TreeCacheMisses, "fd_tree_cache_misses_total", "Shortest-path tree lookups that built a tree."},
+        {MetricCounter::RouteCacheHits, "fd_route_cache_hits_total", "Delivery legs served from the route cache."},
+        {MetricCounter::RouteCacheMisses, "fd_route_cache_misses_total", "Delivery legs that had to be routed."},
+        {MetricCounter::TreesRepaired, "fd_trees_repaired_total", "Cached trees repaired after route changes."},
+        {MetricCounter::TreeNodesRepaired, "fd_tree_nodes_repaired_total", "Nodes settled by tree repair passes."},
+        {MetricCounter::ToursPlanned, "fd_tours_planned_total", "Courier tours produced by the tour planner."},
+        {MetricCounter::OrdersDispatched, "fd_orders_dispatched_total", "Orders matched to couriers by batch dispatch."},
+    };
+    for (const CounterInfo& info : counters) {
+        out << "# HELP " << info.name << ' ' << info.help << '\n'
+            << "# TYPE " << info.name << " counter\n"
+            << info.name << ' ' << snapshot.count(info.counter) << '\n';
+    }
+
+    struct GaugeInfo { const char* name; const char* help; uint64_t value; };
+    const GaugeInfo gauges[] = {
+        {"fd_pending_orders", "Orders currently waiting in the queue.", snapshot.pendingOrders},
+        {"fd_completed_deliveries", "Deliveries currently on the completed stack.", snapshot.completedDeliveries},
+        {"fd_pending_orders_high_water", "Deepest the pending queue has been.", snapshot.peak(MetricHighWater::PendingOrders)},
+        {"fd_completed_deliveries_high_water", "Deepest the completed stack has been.",
+         snapshot.peak(MetricHighWater::CompletedDeliveries)},
+        {"fd_route_cache_bytes", "Bytes held by the route cache.", snapshot.routeCacheBytes},
+    };
+    for (const GaugeInfo& info : gauges) {
+        out << "# HELP " << info.name << ' ' << info.help << '\n'
+            << "# TYPE " << info.name << " gauge\n"
+            << info.name << ' ' << info.value << '\n';
+    }
+
+    struct TimerInfo { MetricTimer timer; const char* name; const char* help; };
+    const TimerInfo timers[] = {
+        {MetricTimer::FindShortestPath, "fd_find_shortest_path_seconds", "Latency of findShortestPath."},
+        {MetricTimer::OptimizeDeliveryRoute, "fd_optimize_delivery_route_seconds", "Latency of optimizeDeliveryRoute."},
+    };
+    for (const TimerInfo& info : timers) {
+        const LatencyHistogram& histogram = snapshot.timer(info.timer);
+        out << "# HELP " << info.name << ' ' << info.help << '\n' << "# TYPE " << info.name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LatencyHistogram::bucketCount; ++b) {
+            cumulative += histogram.buckets[b];
+            out << info.name << "_bucket{le=\"";
+            if (b == LatencyHistogram::bucketCount - 1) out << "+Inf";
+            else out << LatencyHistogram::upperBoundSeconds(b);
+            out << "\"} " << cumulative << '\n';
+        }
+        out << info.name << "_sum " << histogram.sumSeconds << '\n' << info.name << "_count " << histogram.count << '\n';
+    }
+}
+
+
+// JSON-lines event log for state changes. With no sink every event costs a single branch;
+// with one, lines are buffered and written when the buffer fills or on flush().
+class EventLog {
+public:
+    EventLog() = default;
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+    ~EventLog() { flush(); }
+
+    // nullptr switches logging off. The sink must outlive the log or the next open().
+    void open(ostream* destination, size_t bufferBytes = 1 << 16) {
+        flush();
+        lock_guard<mutex> guard(lock);
+        sink = destination;
+        limit = bufferBytes;
+    }
+
+    bool enabled() const { return sink != nullptr; }
+
+    // fields holds further JSON members, each starting with a comma.
+    void write(const char* event, const string& fields) {
+        long long micros = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        lock_guard<mutex> guard(lock);
+        if (!sink) return;
+        buffer += "{\"ts\":" + to_string(micros) + ",\"event\":\"" + event + "\"" + fields + "}\n";
+        if (buffer.size() >= limit) drain();
+    }
+
+    void flush() {
+        lock_guard<mutex> guard(lock);
+        if (sink) drain();
+    }
+
+private:
+    void drain() {
+        sink->write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        sink->flush();
+        buffer.clear();
+    }
+
+    mutex lock;
+    ostream* sink = nullptr;
+    size_t limit = 1 << 16;
+    string buffer;
+};
+
+
+enum class JournalEvent : uint8_t {
+    Placed = 1,
+    Processed,
+    Reverted,
+    Rejected,   // placed but never queued; the slot is dead
+    NextId,     // order.id is the next id to hand out (written by compaction)
+};
+
+// Fixed-size journal record; the checksum covers everything after it, so a torn or stale tail
+// is recognised on replay instead of being applied.
+struct JournalRecord {
+    uint32_t checksum;
+    uint8_t event;
+    uint8_t reserved[3];
+    Order order;
+
+    static uint32_t checksumOf(const JournalRecord& record) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&record) + sizeof(record.checksum);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(JournalRecord) - sizeof(record.checksum); ++i) hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+};
+static_assert(sizeof(JournalRecord) == 40, "journal records are fixed at 40 bytes");
+
+// groupBytes and flushIntervalMs bound how much is written per group commit and how long an
+// appended record may wait for it. durable adds an fsync to every commit.
+struct JournalOptions {
+    size_t groupBytes = 1 << 16;
+    int flushIntervalMs = 5;
+    bool durable = true;
+};
+
+
+// Append-only write-ahead journal of order events with group commit. append() only copies the
+// record into the open group; a background thread writes and syncs whole groups, so appends
+// never wait on the disk. flush() waits until everything appended so far is on disk. A failed
+// write is sticky: later groups are dropped, since replay stops at the torn record anyway, and
+// every flush() until the next open() reports it.
+class OrderJournal {
+public:
+    static constexpr char magic[8] = {'F', 'D', 'J', 'R', 'N', 'L', '0', '1'};
+
+    OrderJournal() = default;
+    OrderJournal(const OrderJournal&) = delete;
+    OrderJournal& operator=(const OrderJournal&) = delete;
+    ~OrderJournal() { close(); }
+
+    // Appends to path, creating it with a header when it does not exist.
+    bool open(const string& path, const JournalOptions& journalOptions, string& error) {
+        close();
+        file = fopen(path.c_str(), "ab");
+        if (!file) {
+            error = "could not open " + path + " for appending";
+            return false;
+        }
+        if (ftell(file) == 0 && (fwrite(magic, 1, sizeof(magic), file) != sizeof(magic) || fflush(file) != 0)) {
+            error = "could not write " + path;
+            fclose(file);
+            file = nullptr;
+            return false;
+        }
+        options = journalOptions;
+        stopping = false;
+        failed = false;
+        open_ = true;
+        group.reserve(options.groupBytes + sizeof(JournalRecord));
+        flusher = thread([this] { flushLoop(); });
+        return true;
+    }
+
+    bool enabled() const { return open_.load(memory_order_relaxed); }
+
+    void append(JournalEvent event, const Order& order) {
+        JournalRecord record = {};
+        record.event = static_cast<uint8_t>(event);
+        record.order = order;
+        record.checksum = JournalRecord::checksumOf(record);
+        lock_guard<mutex> guard(lock);
+        const char* bytes = reinterpret_cast<const char*>(&record);
+        group.insert(group.end(), bytes, bytes + sizeof(record));
+        appended += sizeof(record);
+        if (group.size() >= options.groupBytes) wake.notify_one();
+    }
+
+    // False when a write or sync has failed since open(), or the journal closed before the
+    // records appended so far were committed.
+    bool flush() {
+        unique_lock<mutex> guard(lock);
+        if (!open_) return true;
+        uint64_t target = appended;
+        flushRequested = true;
+        wake.notify_one();
+        committedSignal.wait(guard, [&] { return committed >= target || failed || !open_; });
+        return committed >= target && !failed;
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> guard(lock);
+            if (!open_) return;
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        fclose(file);
+        lock_guard<mutex> guard(lock);
+        file = nullptr;
+        open_ = false;
+        committedSignal.notify_all();
+    }
+
+    // Reads every valid record of a journal file. validBytes ends at the first torn or corrupt
+    // record; a missing file is an empty journal.
+    static bool read(const string& path, vector<JournalRecord>& records, size_t& validBytes, size_t& fileBytes,
+                     string& error) {
+        records.clear();
+        validBytes = fileBytes = 0;
+        FILE* input = fopen(path.c_str(), "rb");
+        if (!input) return true;
+        vector<char> bytes;
+        char chunk[1 << 16];
+        for (size_t got; (got = fread(chunk, 1, sizeof(chunk), input)) > 0;) bytes.insert(bytes.end(), chunk, chunk + got);
+        fclose(input);
+        fileBytes = bytes.size();
+        if (bytes.empty()) return true;
+        if (bytes.size() < sizeof(magic) || memcmp(bytes.data(), magic, sizeof(magic)) != 0) {
+            error = path + " is not an order journal";
+            return false;
+        }
+        validBytes = sizeof(magic);
+        records.reserve((bytes.size() - validBytes) / sizeof(JournalRecord));
+        while (validBytes + sizeof(JournalRecord) <= bytes.size()) {
+            JournalRecord record;
+            memcpy(&record, bytes.data() + validBytes, sizeof(record));
+            if (record.checksum != JournalRecord::checksumOf(record)) break;
+            records.push_back(record);
+            validBytes += sizeof(record);
+        }
+        return true;
+    }
+
+    // Replaces path with exactly these records, via a temporary file and rename.
+    static bool rewrite(const string& path, const vector<JournalRecord>& records, string& error) {
+        string temporary = path + ".tmp";
+        FILE* output = fopen(temporary.c_str(), "wb");
+        bool ok = output && fwrite(magic, 1, sizeof(magic), output) == sizeof(magic) &&
+                  (records.empty() || fwrite(records.data(), sizeof(JournalRecord), records.size(), output) == records.size()) &&
+                  fflush(output) == 0 && sync(output);
+        if (output) ok = fclose(output) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            error = "could not rewrite " + path;
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static bool sync(FILE* stream) {
+#ifndef _WIN32
+        return fsync(fileno(stream)) == 0;
+#else
+        (void)stream;
+        return true;
+#endif
+    }
+
+    void flushLoop() {
+        vector<char> writing;
+        writing.reserve(group.capacity());
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait_for(guard, chrono::milliseconds(options.flushIntervalMs),
+                          [&] { return stopping || flushRequested || group.size() >= options.groupBytes; });
+            bool last = stopping;
+            flushRequested = false;
+            if (!group.empty() && failed) {
+                group.clear();
+            } else if (!group.empty()) {
+                writing.swap(group);
+                uint64_t through = appended;
+                guard.unlock();
+                bool written = fwrite(writing.data(), 1, writing.size(), file) == writing.size() && fflush(file) == 0 &&
+                               (!options.durable || sync(file));
+                writing.clear();
+                guard.lock();
+                if (written) committed = through;
+                else failed = true;
+            }
+            committedSignal.notify_all();
+            if (last && group.empty()) return;
+        }
+    }
+
+    FILE* file = nullptr;
+    JournalOptions options;
+    thread flusher;
+    mutex lock;
+    condition_variable wake;
+    condition_variable committedSignal;
+    vector<char> group;
+    uint64_t appended = 0;
+    uint64_t committed = 0;
+    atomic<bool> open_{false};     // written under lock; enabled() reads it without
+    bool stopping = false;
+    bool failed = false;
+    bool flushRequested = false;
+};
+
+
+class FoodDeliverySystem {
+private:
+    
+    // Pending and completed orders are slab handles; the orders themselves live in allOrders.
+    OrderScheduler incomingOrders;
+    SchedulerOptions schedulerOptions;
+
+    // Wall-clock seconds, so deadlines recovered from the journal keep their meaning.
+    static uint32_t schedulerNow() {
+        return static_cast<uint32_t>(chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    long long dispatchKey(const Order& order) const {
+        long long travel = min<long long>(static_cast<long long>(heuristicEstimate(order.restaurant, order.destination)) *
+                                              schedulerOptions.secondsPerKm, schedulerOptions.maxTravelCredit);
+        long long bonus = min<long long>(llround(max(0.0, order.price) * schedulerOptions.secondsPerDollar),
+                                         schedulerOptions.maxPriceBonus);
+        return static_cast<long long>(order.deadline) - travel - bonus;
+    }
+    
+   
+    // Most recent completions, oldest first; older ones are retired from allOrders.
+    deque<uint32_t> completedOrders;
+    size_t completedWindow = 1 << 16;
+    mutable mutex completedLock;
+    OrderJournal journal;
+
+    vector<Courier> couriers;      // courier id - 1
+    SpatialGrid courierGrid{2.0};
+    SpatialGrid locationGrid{0.5};  // for snapping raw positions to locations
+    uint64_t locationGridVersion = UINT64_MAX;
+
+    void placeCourier(const Courier& courier) {
+        double latitude, longitude;
+        uint32_t item = static_cast<uint32_t>(courier.id - 1);
+        if (locations.coordinates(courier.location, latitude, longitude)) courierGrid.place(item, latitude, longitude);
+        else courierGrid.placeUnlocated(item);
+    }
+
+    Courier* findCourier(int courierId) {
+        return courierId >= 1 && static_cast<size_t>(courierId) <= couriers.size() ? &couriers[courierId - 1] : nullptr;
+    }
+
+    // Closest location with coordinates by straight-line distance, or npos if none has any.
+    uint32_t nearestLocation(double latitude, double longitude) {
+        if (locationGridVersion != locations.coordinateVersion()) {
+            locationGrid.clear();
+            for (uint32_t id = 0; id < locations.size(); ++id) {
+                double lat, lon;
+                if (locations.coordinates(id, lat, lon)) locationGrid.place(id, lat, lon);
+            }
+            locationGridVersion = locations.coordinateVersion();
+        }
+        uint32_t best = LocationTable::npos;
+        double bestKm = numeric_limits<double>::infinity();
+        locationGrid.search(latitude, longitude, [&](uint32_t id) {
+            double lat, lon;
+            locations.coordinates(id, lat, lon);
+            double km = haversineKm(latitude, longitude, lat, lon);
+            if (km < bestKm) {
+                bestKm = km;
+                best = id;
+            }
+        }, [&](double boundKm) { return boundKm < bestKm; });
+        return best;
+    }
+
+    // k nearest available couriers to origin by network distance, closest first. The grid hands
+    // out candidates ring by ring until k are in hand; one bounded Dijkstra from origin prices
+    // them (routes are two-way, so origin -> courier equals courier -> origin). If the k-th is
+    // further than the ring bound, the rings are widened to that distance and priced once more,
+    // which is exact whenever routes are no shorter than the straight line.
+    void nearestCouriers(const CsrGraph& g, uint32_t origin, size_t k, vector<CourierDistance>& nearest) const {
+        nearest.clear();
+        if (k == 0 || origin >= g.nodeCount() || couriers.empty()) return;
+        double latitude, longitude;
+        bool located = locations.coordinates(origin, latitude, longitude);
+        vector<uint32_t> candidates, nodes;
+        vector<int> distances;
+        int limit = INT_MAX;
+        for (int pass = 0; pass < 2; ++pass) {
+            candidates.clear();
+            size_t inRings = 0;  // couriers without coordinates say nothing about the ring bound
+            double boundKm = numeric_limits<double>::infinity();
+            auto collect = [&](uint32_t item) {
+                if (!couriers[item].available) return;
+                candidates.push_back(item);
+                if (courierGrid.located(item)) ++inRings;
+            };
+            if (located && !(pass == 1 && limit == INT_MAX)) {
+                courierGrid.search(latitude, longitude, collect, [&](double ringKm) {
+                    bool enough = pass == 0 ? inRings >= k : ringKm >= limit;
+                    if (enough) boundKm = ringKm;
+                    return !enough;
+                });
+            } else {
+                courierGrid.forEach(collect);
+            }
+
+            SearchContext& targetMarks = threadSearchWorkspace().marks;
+            targetMarks.begin(g.nodeCount());
+            uint32_t targetCount = 0;
+            nodes.clear();
+            for (uint32_t item : candidates) {
+                uint32_t node = couriers[item].location;
+                nodes.push_back(node);
+                if (node < g.nodeCount() && targetMarks.distance(node) == INT_MAX) {
+                    targetMarks.update(node, 0, LocationTable::npos);
+                    ++targetCount;
+                }
+            }
+            // Settling k marked nodes settles at least k couriers, and unsettled ones can only come after them.
+            distances.assign(nodes.size(), INT_MAX);
+            SearchStats stats;
+            uint32_t settle = min(targetCount, static_cast<uint32_t>(min<size_t>(k, UINT32_MAX)));
+            withFrontiers(frontierKind, [&](auto& frontiers) {
+                oneToMany(g, origin, targetMarks, settle, nodes.data(), nodes.size(), distances.data(), frontiers[0], stats, limit);
+            });
+
+            nearest.clear();
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                if (distances[i] != INT_MAX) nearest.push_back({couriers[candidates[i]].id, distances[i]});
+            }
+            sort(nearest.begin(), nearest.end(), [](const CourierDistance& a, const CourierDistance& b) {
+                return a.distance != b.distance ? a.distance < b.distance : a.courierId < b.courierId;
+            });
+            if (nearest.size() > k) nearest.resize(k);
+            if (nearest.size() == k ? nearest.back().distance <= boundKm : boundKm == numeric_limits<double>::infinity()) return;
+            limit = nearest.size() == k ? nearest.back().distance : INT_MAX;
+        }
+    }
+
+    // Agent leg from the nearest available courier, read off the restaurant's tree.
+    void assignNearestCourier(const CsrGraph& g, uint32_t restaurantId, const ShortestPathTree& restaurantTree,
+                              DeliveryRoute& route) const {
+        vector<CourierDistance> nearest;
+        nearestCouriers(g, restaurantId, 1, nearest);
+        if (nearest.empty()) return;
+        uint32_t start = couriers[nearest[0].courierId - 1].location;
+        route.courierId = nearest[0].courierId;
+        route.agentDistance = restaurantTree.distanceTo(start);
+        route.agentPath = restaurantTree.pathTo(start);
+        reverse(route.agentPath.begin(), route.agentPath.end());
+    }
+
+    // Thread-safe single-target search on a frozen graph.
+    void routeLeg(const CsrGraph& g, uint32_t source, uint32_t target, int& distance, vector<uint32_t>& path) {
+        SearchContext& context = threadSearchWorkspace().sides[0];
+        SearchStats stats;
+        bool found = withFrontiers(frontierKind, [&](auto& frontiers) {
+            return labelSetting(g, StaticWeights{g}, context, NoBound(), source, target, frontiers[0], stats);
+        });
+        distance = found ? context.distance(target) : INT_MAX;
+        path = found ? context.tracePath(target) : vector<uint32_t>();
+        MetricsShard& shard = metricsRegistry.local();
+        shard.add(MetricCounter::Searches);
+        shard.add(MetricCounter::NodesSettled, stats.nodesSettled);
+        shard.add(MetricCounter::EdgesRelaxed, stats.edgesRelaxed);
+    }
+
+    void rejectOrder(uint32_t handle) {
+        const Order order = allOrders.at(handle);
+        if (journal.enabled()) journal.append(JournalEvent::Rejected, order);
+        allOrders.retire(handle);
+        metricsRegistry.local().add(MetricCounter::OrdersRejected);
+        logOrder("order_rejected", order);
+    }
+
+#if FD_COROUTINES
+    struct PipelineOrder {
+        uint32_t handle;
+        DeliveryRoute route;
+    };
+
+    // What one runOrderPipeline call's stages share. Only the assignment stage touches couriers
+    // and only the completion stage writes result, so neither needs a lock. The executor is
+    // declared last so it is joined first: a stage may still be inside close() when done is set.
+    struct PipelineRun {
+        PipelineRun(unsigned threads, size_t capacity)
+            : routing(executor, capacity), assigning(executor, capacity), delivering(executor, capacity),
+              completing(executor, capacity), executor(threads) {}
+
+        const CsrGraph* graph = nullptr;
+        const ShortestPathTree* depotTree = nullptr;  // agent legs when there are no couriers
+        uint64_t cacheGeneration = 0;
+        StageQueue<uint32_t> routing;
+        StageQueue<PipelineOrder> assigning;
+        StageQueue<PipelineOrder> delivering;
+        StageQueue<PipelineOrder> completing;
+        atomic<unsigned> routers{0};
+        atomic<size_t> rejected{0};
+        atomic<size_t> inDelivery{0};
+        vector<uint32_t> requeue;  // no courier free; pushed back once the run ends
+        PipelineResult result;
+
+        mutex doneLock;
+        condition_variable doneSignal;
+        bool done = false;
+
+        PipelineExecutor executor;
+    };
+
+    StageTask intakeStage(PipelineRun& run) {
+        uint32_t handle;
+        while (incomingOrders.pop(handle)) {
+            const Order& order = allOrders.at(handle);
+            if (order.restaurant >= run.graph->nodeCount() || order.destination >= run.graph->nodeCount()) {
+                rejectOrder(handle);
+                ++run.rejected;
+                continue;
+            }
+            co_await run.routing.push(handle);
+        }
+        run.routing.close();
+    }
+
+    StageTask routeStage(PipelineRun& run) {
+        while (optional<uint32_t> handle = co_await run.routing.pop()) {
+            const Order& order = allOrders.at(*handle);
+            PipelineOrder item{*handle, DeliveryRoute()};
+            DeliveryRoute& route = item.route;
+            route.orderId = order.id;
+            route.status = Status::Ok;
+            if (!cachedDeliveryLeg(order.restaurant, order.destination, route)) {
+                routeLeg(*run.graph, order.restaurant, order.destination, route.deliveryDistance, route.deliveryPath);
+                routeCache.insert(order.restaurant, order.destination, run.cacheGeneration, route.deliveryDistance, route.deliveryPath);
+            }
+            if (route.deliveryDistance == INT_MAX) {
+                rejectOrder(*handle);
+                ++run.rejected;
+                continue;
+            }
+            co_await run.assigning.push(move(item));
+        }
+        if (run.routers.fetch_sub(1) == 1) run.assigning.close();
+    }
+
+    StageTask assignStage(PipelineRun& run) {
+        vector<CourierDistance> nearest;
+        while (optional<PipelineOrder> item = co_await run.assigning.pop()) {
+            const Order& order = allOrders.at(item->handle);
+            DeliveryRoute& route = item->route;
+            if (run.depotTree) {
+                route.agentDistance = run.depotTree->distanceTo(order.restaurant);
+                route.agentPath = run.depotTree->pathTo(order.restaurant);
+            } else {
+                nearestCouriers(*run.graph, order.restaurant, 1, nearest);
+                if (nearest.empty()) {
+                    run.requeue.push_back(item->handle);
+                    continue;
+                }
+                Courier& courier = couriers[nearest[0].courierId - 1];
+                courier.available = false;
+                route.courierId = courier.id;
+                routeLeg(*run.graph, courier.location, order.restaurant, route.agentDistance, route.agentPath);
+            }
+            co_await run.delivering.push(move(*item));
+        }
+        run.delivering.close();
+    }
+
+    // Orders are on the road here; nothing simulates the drive, so they go straight on.
+    StageTask deliveryStage(PipelineRun& run) {
+        while (optional<PipelineOrder> item = co_await run.delivering.pop()) {
+            ++run.inDelivery;
+            logOrder("order_in_delivery", allOrders.at(item->handle));
+            co_await run.completing.push(move(*item));
+        }
+        run.completing.close();
+    }
+
+    StageTask completionStage(PipelineRun& run) {
+        while (optional<PipelineOrder> item = co_await run.completing.pop()) {
+            const Order order = allOrders.at(item->handle);
+            size_t completed;
+            {
+                lock_guard<mutex> guard(completedLock);
+                if (journal.enabled()) journal.append(JournalEvent::Processed, order);
+                completedOrders.push_back(item->handle);
+                trimCompletedWindow();
+                completed = completedOrders.size();
+            }
+            --run.inDelivery;
+            MetricsShard& metrics = metricsRegistry.local();
+            metrics.add(MetricCounter::OrdersProcessed);
+            metrics.add(MetricCounter::RoutesOptimized);
+            metrics.raise(MetricHighWater::CompletedDeliveries, completed);
+            logRoute(item->route);
+            logOrder("order_delivered", order);
+            run.result.routes.push_back(move(item->route));
+        }
+        lock_guard<mutex> guard(run.doneLock);
+        run.done = true;
+        run.doneSignal.notify_all();
+    }
+#endif
+
+    // Caller holds completedLock.
+    void trimCompletedWindow() {
+        while (completedOrders.size() > completedWindow) {
+            allOrders.retire(completedOrders.front());
+            completedOrders.pop_front();
+        }
+    }
+    
+    
+    LocationTable locations;
+
+    // Mutable staging adjacency written by addRoute; frozen into a new published version on
+    // demand. After a snapshot load the published graph points into the mapped file and the
+    // staging copy is only built by the first edit.
+    vector<vector<pair<uint32_t, int>>> stagedRoutes;
+    GraphVersions graphVersions;
+    bool graphDirty = false;
+    bool routesStaged = true;
+    shared_ptr<MappedFile> networkFile;
+
+    EventLog eventLog;
+    mutable MetricsRegistry metricsRegistry;
+    uint64_t graphVersion = 0;
+
+    ContractionHierarchy contractionHierarchy;
+    uint64_t hierarchyVersion = 0;
+
+    RegionOverlay regionOverlay;
+    uint64_t overlayVersion = 0;
+    uint32_t regionSize = 1024;
+
+    TravelProfiles travelProfiles;
+    unordered_map<uint64_t, uint32_t> routeProfiles;  // from << 32 | to -> profile id
+    uint64_t profilesVersion = UINT64_MAX;
+
+    unique_ptr<ThreadPool> pool;
+
+    ThreadPool& workers() {
+        if (!pool) pool.reset(new ThreadPool(thread::hardware_concurrency()));
+        return *pool;
+    }
+    
+    
+    OrderSlab allOrders;
+
+    // The writer's view: publishes staged edits first, so it is always current. Other threads
+    // read through GraphVersions::Reader instead.
+    const CsrGraph& graph() {
+        if (routesStaged && (graphDirty || graphVersions.latest().graph.nodeCount() != stagedRoutes.size())) {
+            unique_ptr<GraphSnapshot> next(new GraphSnapshot());
+            next->graph.build(stagedRoutes);
+            next->version = ++graphVersion;
+            graphVersions.publish(move(next));
+            graphDirty = false;
+        }
+        return graphVersions.latest().graph;
+    }
+
+    // Built on first use; later weight changes re-contract with the existing node order.
+    const ContractionHierarchy& hierarchy() {
+        const CsrGraph& g = graph();
+        if (contractionHierarchy.empty() || hierarchyVersion != graphVersion) {
+            if (contractionHierarchy.nodeCount() == g.nodeCount()) {
+                contractionHierarchy.customize(g);
+            } else {
+                contractionHierarchy.build(g);
+            }
+            hierarchyVersion = graphVersion;
+        }
+        return contractionHierarchy;
+    }
+
+    // Partitioned on first use; route changes only recompute the boundary and shortcuts, new
+    // locations re-partition.
+    const RegionOverlay& overlay() {
+        const CsrGraph& g = graph();
+        if (regionOverlay.empty() || overlayVersion != graphVersion) {
+            if (regionOverlay.nodeCount() == g.nodeCount()) {
+                regionOverlay.customize(g);
+            } else {
+                NodeOrder method = NodeOrder::Auto;
+                regionOverlay.build(g, localityOrder(g, locations, method), regionSize);
+            }
+            overlayVersion = graphVersion;
+        }
+        return regionOverlay;
+    }
+
+    // Profile ids follow the CSR edges, so they are re-laid whenever the graph is rebuilt.
+    const TravelProfiles& profiles() {
+        const CsrGraph& g = graph();
+        if (profilesVersion != graphVersion) {
+            travelProfiles.attach(g, routeProfiles);
+            profilesVersion = graphVersion;
+        }
+        return travelProfiles;
+    }
+
+    // Checks the header against the file and the CSR arrays against each other, so a
+    // truncated or foreign file is rejected instead of read out of bounds.
+    static bool validNetworkFile(const MappedFile& file, NetworkFileHeader& header) {
+        if (file.size() < sizeof(header)) return false;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, networkFileMagic, sizeof(header.magic)) != 0 ||
+            header.version != NetworkFileHeader::currentVersion || header.byteOrder != NetworkFileHeader::byteOrderMark ||
+            header.fileSize != file.size() || header.nameBytes > UINT32_MAX) {
+            return false;
+        }
+        uint64_t n = header.nodeCount, m = header.edgeCount;
+        const pair<uint64_t, uint64_t> sections[] = {
+            {header.offsetsAt, (n + 1) * sizeof(uint32_t)}, {header.targetsAt, m * sizeof(uint32_t)},
+            {header.weightsAt, m * sizeof(int)},            {header.coordinatesAt, 2 * n * sizeof(double)},
+            {header.nameIndexAt, (n + 1) * sizeof(uint32_t)}, {header.sortedAt, n * sizeof(uint32_t)},
+            {header.namesAt, header.nameBytes},
+        };
+        for (const auto& section : sections) {
+            if (section.first % 8 != 0 || section.first < sizeof(header) || section.first > file.size() ||
+                section.second > file.size() - section.first) {
+                return false;
+            }
+        }
+
+        const char* base = file.data();
+        const uint32_t* offsets = reinterpret_cast<const uint32_t*>(base + header.offsetsAt);
+        const uint32_t* targets = reinterpret_cast<const uint32_t*>(base + header.targetsAt);
+        const int* weights = reinterpret_cast<const int*>(base + header.weightsAt);
+        const uint32_t* nameIndex = reinterpret_cast<const uint32_t*>(base + header.nameIndexAt);
+        const uint32_t* sorted = reinterpret_cast<const uint32_t*>(base + header.sortedAt);
+        if (offsets[0] != 0 || offsets[n] != m || nameIndex[0] != 0 || nameIndex[n] != header.nameBytes) return false;
+        for (uint64_t u = 0; u < n; ++u) {
+            if (offsets[u] > offsets[u + 1] || nameIndex[u] > nameIndex[u + 1] || sorted[u] >= n) return false;
+            for (uint32_t e = offsets[u]; e < offsets[u + 1]; ++e) {
+                if (targets[e] >= n || weights[e] < 0 || (e > offsets[u] && targets[e - 1] >= targets[e])) return false;
+            }
+        }
+        return true;
+    }
+
+    void logOrder(const char* event, const Order& order) {
+        if (!eventLog.enabled()) return;
+        eventLog.write(event, ",\"orderId\":" + to_string(order.id) + ",\"restaurant\":" + to_string(order.restaurant) +
+                                  ",\"destination\":" + to_string(order.destination) + ",\"price\":" + to_string(order.price));
+    }
+
+    void logRoute(const DeliveryRoute& route) {
+        if (!eventLog.enabled() || route.status != Status::Ok) return;
+        string fields = ",\"orderId\":" + to_string(route.orderId) + ",\"totalDistance\":";
+        writeJsonDistance(fields, route.totalDistance());
+        eventLog.write("route_optimized", fields);
+    }
+
+    void logRouteAdded(uint32_t from, uint32_t to, int distance) {
+        if (!eventLog.enabled()) return;
+        eventLog.write("route_added", ",\"from\":" + to_string(from) + ",\"to\":" + to_string(to) +
+                                          ",\"distance\":" + to_string(distance));
+    }
+
+    void stageRoutes() {
+        if (routesStaged) return;
+        const CsrGraph& frozen = graphVersions.latest().graph;
+        stagedRoutes.assign(frozen.nodeCount(), {});
+        for (uint32_t u = 0; u < frozen.nodeCount(); ++u) {
+            for (uint32_t e = frozen.edgeBegin(u); e < frozen.edgeEnd(u); ++e) {
+                stagedRoutes[u].push_back({frozen.target(e), frozen.weight(e)});
+            }
+        }
+        routesStaged = true;
+    }
+
+    // Stages a two-way route between existing ids and records the change for tree repair.
+    void stageRoute(uint32_t from, uint32_t to, int distance, vector<EdgeChange>& changes) {
+        stageRoutes();
+        int previous = stageEdge(from, to, distance);
+        stageEdge(to, from, distance);
+        if (previous != distance) {
+            graphDirty = true;
+            routeCache.invalidate();
+            changes.push_back({from, to, previous, distance});
+        }
+    }
+
+    void connect(uint32_t from, uint32_t to, int distance) {
+        vector<EdgeChange> changes;
+        stageRoute(from, to, distance, changes);
+        repairPathTrees(changes);
+    }
+
+    uint32_t internLocation(const string& name, bool& inserted) {
+        uint32_t id = locations.intern(name, inserted);
+        if (inserted) {
+            stageRoutes();
+            stagedRoutes.emplace_back();
+        }
+        return id;
+    }
+
+    // Returns the previous weight, or INT_MAX if the edge is new.
+    int stageEdge(uint32_t from, uint32_t to, int distance) {
+        for (auto& edge : stagedRoutes[from]) {
+            if (edge.first == to) {
+                int previous = edge.second;
+                edge.second = distance;
+                return previous;
+            }
+        }
+        stagedRoutes[from].push_back({to, distance});
+        return INT_MAX;
+    }
+
+    // Cached trees keyed by source id (Depot and restaurants in practice).
+    unordered_map<uint32_t, ShortestPathTree> pathTrees;
+
+    // Delivery legs by (restaurant, destination); emptied by any route change.
+    RouteCache routeCache;
+
+    // Thread-safe; counts the lookup either way.
+    bool cachedDeliveryLeg(uint32_t restaurant, uint32_t destination, DeliveryRoute& route) {
+        bool hit = routeCache.find(restaurant, destination, route.deliveryDistance, route.deliveryPath);
+        metricsRegistry.local().add(hit ? MetricCounter::RouteCacheHits : MetricCounter::RouteCacheMisses);
+        return hit;
+    }
+
+    void buildShortestPathTree(uint32_t source, ShortestPathTree& tree) {
+        buildShortestPathTree(graph(), source, tree, frontierKind);
+    }
+
+    // Only reads g, so worker threads can run it concurrently on a frozen graph.
+    static void buildShortestPathTree(const CsrGraph& g, uint32_t source, ShortestPathTree& tree, FrontierKind kind) {
+        withFrontiers(kind, [&](auto& frontiers) { growShortestPathTree(g, source, tree, frontiers[0]); });
+    }
+
+    // The tree arrays are the output; only the frontier is borrowed from the thread's workspace.
+    template <typename Frontier>
+    static void growShortestPathTree(const CsrGraph& g, uint32_t source, ShortestPathTree& tree, Frontier& frontier) {
+        TreeLabels labels{tree, nullptr, nullptr};
+        tree.source = source;
+        if (source >= g.nodeCount()) {
+            labels.begin(g.nodeCount());
+            return;
+        }
+        SearchStats stats;
+        labelSetting(g, StaticWeights{g}, labels, NoBound(), source, LocationTable::npos, frontier, stats);
+    }
+
+    const ShortestPathTree& shortestPathTree(uint32_t source) {
+        auto it = pathTrees.find(source);
+        if (it == pathTrees.end()) {
+            metricsRegistry.local().add(MetricCounter::TreeCacheMisses);
+            it = pathTrees.emplace(source, ShortestPathTree()).first;
+            buildShortestPathTree(source, it->second);
+        } else {
+            metricsRegistry.local().add(MetricCounter::TreeCacheHits);
+        }
+        return it->second;
+    }
+
+    void recordSearch() {
+        MetricsShard& shard = metricsRegistry.local();
+        shard.add(MetricCounter::Searches);
+        shard.add(MetricCounter::NodesSettled, lastSearchStats.nodesSettled);
+        shard.add(MetricCounter::EdgesRelaxed, lastSearchStats.edgesRelaxed);
+    }
+
+    void repairPathTrees(const vector<EdgeChange>& changes) {
+        if (changes.empty() || pathTrees.empty()) return;
+        vector<EdgeChange> merged = mergeEdgeChanges(changes);
+        for (auto& entry : pathTrees) repairPathTree(entry.second, merged);
+    }
+
+    // One change per route, from its weight before the batch to its weight after it, so an
+    // intermediate weight never reaches the repair. Routes back at their old weight drop out.
+    static vector<EdgeChange> mergeEdgeChanges(const vector<EdgeChange>& changes) {
+        vector<EdgeChange> merged;
+        unordered_map<uint64_t, size_t> index;
+        for (const EdgeChange& change : changes) {
+            uint64_t key = static_cast<uint64_t>(min(change.from, change.to)) << 32 | max(change.from, change.to);
+            auto inserted = index.emplace(key, merged.size());
+            if (inserted.second) merged.push_back(change);
+            else merged[inserted.first->second].newWeight = change.newWeight;
+        }
+        merged.erase(remove_if(merged.begin(), merged.end(), [](const EdgeChange& change) { return change.oldWeight == change.newWeight; }),
+                     merged.end());
+        return merged;
+    }
+
+    // Dynamic SSSP repair in the style of Ramalingam and Reps, run on the staging adjacency so
+    // no CSR rebuild is needed. Subtrees hanging off tree edges that got heavier are detached
+    // and re-seeded from their remaining neighbours, endpoints of edges that got lighter are
+    // relaxed, and one Dijkstra pass from those seeds settles everything else that moves.
+    // Nodes whose distance cannot change are never visited.
+    void repairPathTree(ShortestPathTree& tree, const vector<EdgeChange>& changes) {
+        uint32_t n = static_cast<uint32_t>(stagedRoutes.size());
+        vector<int>& dist = tree.distances;
+        vector<uint32_t>& pred = tree.predecessors;
+        if (dist.size() < n) {
+            dist.resize(n, INT_MAX);
+            pred.resize(n, LocationTable::npos);
+        }
+
+        // Collect every node whose tree path crosses an edge that got heavier.
+        SearchContext& detached = threadSearchWorkspace().marks;
+        detached.begin(n);
+        repairScratch.clear();
+        for (const EdgeChange& change : changes) {
+            if (change.oldWeight == INT_MAX || change.newWeight <= change.oldWeight) continue;
+            const uint32_t ends[2][2] = {{change.from, change.to}, {change.to, change.from}};
+            for (const auto& end : ends) {
+                uint32_t parent = end[0], child = end[1];
+                if (pred[child] != parent || detached.distance(child) != INT_MAX) continue;
+                size_t first = repairScratch.size();
+                detached.update(child, 0, LocationTable::npos);
+                repairScratch.push_back(child);
+                for (size_t i = first; i < repairScratch.size(); ++i) {
+                    uint32_t node = repairScratch[i];
+                    for (const auto& edge : stagedRoutes[node]) {
+                        if (pred[edge.first] == node && detached.distance(edge.first) == INT_MAX) {
+                            detached.update(edge.first, 0, LocationTable::npos);
+                            repairScratch.push_back(edge.first);
+                        }
+                    }
+                }
+            }
+        }
+        for (uint32_t node : repairScratch) {
+            dist[node] = INT_MAX;
+            pred[node] = LocationTable::npos;
+        }
 
-class FoodDeliverySystem {
-private:
-    
-    queue<Order> incomingOrders;
-    
-   
-    stack<Order> completedOrders;
-    
-    
-    map<string, map<string, int>> deliveryGraph;
-    
-    
-    map<int, Order> allOrders;
-    
- 
-    int nextOrderId = 1001;
+        BinaryHeapFrontier& frontier = threadSearchWorkspace().binary[0];
+        frontier.begin(n);
+        auto relax = [&](uint32_t from, uint32_t to, int weight) {
+            if (dist[from] == INT_MAX || addDistance(dist[from], weight) >= dist[to]) return;
+            dist[to] = addDistance(dist[from], weight);
+            pred[to] = from;
+            frontier.push(dist[to], dist[to], to);
+        };
+        for (uint32_t node : repairScratch) {
+            for (const auto& edge : stagedRoutes[node]) relax(edge.first, node, edge.second);
+        }
+        for (const EdgeChange& change : changes) {
+            if (change.newWeight >= change.oldWeight) continue;
+            relax(change.from, change.to, change.newWeight);
+            relax(change.to, change.from, change.newWeight);
+        }
 
-   
-    vector<string> findShortestPath(const string& start, const string& end) {
-      
-        map<string, int> distances;
-      
-        map<string, string> predecessors;
-        
-        set<string> visited;
-        
-        priority_queue<pair<int, string>, vector<pair<int, string>>, greater<pair<int, string>>> pq;
+        uint64_t settled = 0;
+        while (!frontier.empty()) {
+            FrontierEntry entry = frontier.pop();
+            if (entry.distance > dist[entry.node]) continue;
+            ++settled;
+            for (const auto& edge : stagedRoutes[entry.node]) relax(entry.node, edge.first, edge.second);
+        }
+
+        MetricsShard& metrics = metricsRegistry.local();
+        metrics.add(MetricCounter::TreesRepaired);
+        metrics.add(MetricCounter::TreeNodesRepaired, settled);
+    }
 
-        for (const auto& pair : deliveryGraph) {
-            distances[pair.first] = INT_MAX;
+    vector<uint32_t> repairScratch;
+
+    SearchMode searchMode = SearchMode::Dijkstra;
+    FrontierKind frontierKind = FrontierKind::BinaryHeap;
+
+    // Calls run(frontiers) with this thread's pair of frontiers of the requested kind.
+    template <typename Run>
+    static auto withFrontiers(FrontierKind kind, Run run) -> decltype(run(threadSearchWorkspace().binary)) {
+        SearchWorkspace& workspace = threadSearchWorkspace();
+        switch (kind) {
+            case FrontierKind::QuaternaryHeap: return run(workspace.quaternary);
+            case FrontierKind::RadixHeap: return run(workspace.radix);
+            case FrontierKind::BinaryHeap: break;
         }
+        return run(workspace.binary);
+    }
+    SearchHeuristic searchHeuristic;
+    SearchStats lastSearchStats;
+
+    int heuristicEstimate(uint32_t node, uint32_t target) const {
+        if (searchHeuristic) return searchHeuristic(node, target);
+        double fromLatitude, fromLongitude, toLatitude, toLongitude;
+        if (!locations.coordinates(node, fromLatitude, fromLongitude) ||
+            !locations.coordinates(target, toLatitude, toLongitude)) return 0;
+        return static_cast<int>(floor(haversineKm(fromLatitude, fromLongitude, toLatitude, toLongitude)));
+    }
 
-        if (distances.find(start) == distances.end()) return {}; 
+    template <typename Frontier>
+    PathResult dijkstraSearch(const CsrGraph& g, uint32_t start, uint32_t end, Frontier& frontier) {
+        SearchContext& context = threadSearchWorkspace().sides[0];
+        if (!labelSetting(g, StaticWeights{g}, context, NoBound(), start, end, frontier, lastSearchStats)) return PathResult();
+        return {context.distance(end), context.tracePath(end), {}};
+    }
 
-        
-        distances[start] = 0;
-        pq.push({0, start});
+    // Nodes may be reopened, so a merely admissible (not consistent) heuristic stays exact.
+    template <typename Frontier>
+    PathResult aStarSearch(const CsrGraph& g, uint32_t start, uint32_t end, Frontier& frontier) {
+        SearchContext& context = threadSearchWorkspace().sides[0];
+        auto bound = [&](uint32_t node) { return heuristicEstimate(node, end); };
+        if (!labelSetting(g, StaticWeights{g}, context, bound, start, end, frontier, lastSearchStats)) return PathResult();
+        return {context.distance(end), context.tracePath(end), {}};
+    }
 
-        while (!pq.empty()) {
-            string current = pq.top().second;
-            pq.pop();
+    // Earliest arrival leaving start at `departure`: Dijkstra, or A* under a travel-time lower
+    // bound, where an edge costs its travel time at the moment it is entered. Labels are elapsed
+    // seconds. Exact while every edge is FIFO (leaving later never arrives earlier), which a
+    // profile only breaks by falling faster than one second per second across a slot.
+    template <typename Frontier>
+    PathResult timeDependentSearch(const CsrGraph& g, const TravelProfiles& profiles, uint32_t start, uint32_t end,
+                                   uint32_t departure, bool goalDirected, Frontier& frontier) {
+        int secondsPerKm = schedulerOptions.secondsPerKm;
+        long long boundScale = static_cast<long long>(secondsPerKm) * profiles.fastestFactor();
+        auto bound = [&](uint32_t node) {
+            if (!goalDirected) return 0;
+            return static_cast<int>(min<long long>(heuristicEstimate(node, end) * boundScale / TravelProfiles::freeFlow, INT_MAX / 2));
+        };
+        SearchContext& context = threadSearchWorkspace().sides[0];
+        TimeDependentWeights weights{g, profiles, departure, secondsPerKm};
+        if (!labelSetting(g, weights, context, bound, start, end, frontier, lastSearchStats)) return PathResult();
+        PathResult result = {context.distance(end), context.tracePath(end), {}};
+        for (size_t i = 0; i + 1 < result.nodes.size(); ++i) {
+            result.legs.push_back(context.distance(result.nodes[i + 1]) - context.distance(result.nodes[i]));
+        }
+        return result;
+    }
 
-            if (visited.count(current)) continue;
-            visited.insert(current);
-
-         
-            if (deliveryGraph.count(current)) {
-                for (const auto& edge : deliveryGraph[current]) {
-                    string neighbor = edge.first;
-                    int weight = edge.second;
-                   
-                    if (distances[current] != INT_MAX && distances[current] + weight < distances[neighbor]) {
-                        distances[neighbor] = distances[current] + weight;
-                        predecessors[neighbor] = current;
-                        pq.push({distances[neighbor], neighbor});
-                    }
+    // Routes are always stored in both directions, so the backward search reuses the same edges.
+    template <typename Frontier>
+    PathResult bidirectionalSearch(const CsrGraph& g, uint32_t start, uint32_t end, Frontier* frontiers) {
+        if (start == end) return {0, {start}, {}};
+        SearchContext* sides = threadSearchWorkspace().sides;
+        for (int side = 0; side < 2; ++side) {
+            sides[side].begin(g.nodeCount());
+            frontiers[side].begin(g.nodeCount());
+        }
+        sides[0].update(start, 0, LocationTable::npos);
+        sides[1].update(end, 0, LocationTable::npos);
+        frontiers[0].push(0, 0, start);
+        frontiers[1].push(0, 0, end);
+
+        int best = INT_MAX;
+        uint32_t meeting = LocationTable::npos;
+
+        while (!frontiers[0].empty() && !frontiers[1].empty()) {
+            if (frontiers[0].top().key + frontiers[1].top().key >= best) break;
+
+            int side = frontiers[0].size() <= frontiers[1].size() ? 0 : 1;
+            SearchContext& context = sides[side];
+            FrontierEntry entry = frontiers[side].pop();
+            uint32_t current = entry.node;
+            int dist = entry.distance;
+
+            if (dist > context.distance(current)) continue;
+            ++lastSearchStats.nodesSettled;
+
+            for (uint32_t e = g.edgeBegin(current); e < g.edgeEnd(current); ++e) {
+                uint32_t neighbor = g.target(e);
+                int candidate = addDistance(dist, g.weight(e));
+                ++lastSearchStats.edgesRelaxed;
+                if (candidate < context.distance(neighbor)) {
+                    context.update(neighbor, candidate, current);
+                    frontiers[side].push(candidate, candidate, neighbor);
+                }
+                int other = sides[1 - side].distance(neighbor);
+                if (other != INT_MAX && addDistance(candidate, other) < best) {
+                    best = addDistance(candidate, other);
+                    meeting = neighbor;
                 }
             }
         }
 
-        
-        vector<string> path;
-        string current = end;
-        if (distances.find(end) == distances.end() || distances[end] == INT_MAX) return {};
+        if (meeting == LocationTable::npos) return PathResult();
+        PathResult result{best, sides[0].tracePath(meeting), {}};
+        for (uint32_t current = sides[1].predecessor(meeting); current != LocationTable::npos; current = sides[1].predecessor(current)) {
+            result.nodes.push_back(current);
+        }
+        return result;
+    }
 
-        while (predecessors.count(current)) {
-            path.push_back(current);
-            current = predecessors[current];
-            if (current == start) {
-                path.push_back(start);
-                break;
+    // oneToMany over a target list that may repeat nodes; distances lines up with targets and the
+    // search tree is left in the thread's sides[0].
+    void multiTargetSearch(const CsrGraph& g, uint32_t source, const vector<uint32_t>& targets, vector<int>& distances,
+                           SearchStats& stats) const {
+        SearchContext& targetMarks = threadSearchWorkspace().marks;
+        targetMarks.begin(g.nodeCount());
+        uint32_t targetCount = 0;
+        for (uint32_t target : targets) {
+            if (targetMarks.distance(target) == INT_MAX) {
+                targetMarks.update(target, 0, LocationTable::npos);
+                ++targetCount;
             }
         }
-        reverse(path.begin(), path.end());
-        
-        if (!path.empty() && path.front() == start) return path;
-        return {}; 
+        withFrontiers(frontierKind, [&](auto& frontiers) {
+            oneToMany(g, source, targetMarks, targetCount, targets.data(), targets.size(), distances.data(), frontiers[0], stats);
+        });
+    }
+
+    // Plain Dijkstra from source that stops once every node flagged in targetMarks is settled, or
+    // once nothing within limit is left to settle.
+    template <typename Frontier>
+    static void oneToMany(const CsrGraph& g, uint32_t source, const SearchContext& targetMarks, uint32_t targetCount,
+                          const uint32_t* targets, size_t columns, int* row, Frontier& frontier, SearchStats& stats,
+                          int limit = INT_MAX) {
+        SearchContext& context = threadSearchWorkspace().sides[0];
+        context.begin(g.nodeCount());
+        frontier.begin(g.nodeCount());
+        context.update(source, 0, LocationTable::npos);
+        frontier.push(0, 0, source);
+
+        while (!frontier.empty() && targetCount > 0 && (limit == INT_MAX || frontier.top().distance <= limit)) {
+            FrontierEntry entry = frontier.pop();
+            uint32_t current = entry.node;
+            int dist = entry.distance;
+
+            if (dist > context.distance(current)) continue;
+            ++stats.nodesSettled;
+            if (targetMarks.distance(current) != INT_MAX) --targetCount;
+
+            for (uint32_t e = g.edgeBegin(current); e < g.edgeEnd(current); ++e) {
+                uint32_t neighbor = g.target(e);
+                int candidate = addDistance(dist, g.weight(e));
+                ++stats.edgesRelaxed;
+                if (candidate < context.distance(neighbor)) {
+                    context.update(neighbor, candidate, current);
+                    frontier.push(candidate, candidate, neighbor);
+                }
+            }
+        }
+
+        // Unsettled targets past the limit only hold tentative distances above it.
+        for (size_t col = 0; col < columns; ++col) {
+            int distance = targets[col] < g.nodeCount() ? context.distance(targets[col]) : INT_MAX;
+            row[col] = distance <= limit ? distance : INT_MAX;
+        }
+    }
+
+    DistanceMatrix distanceMatrix(const vector<uint32_t>& sources, const vector<uint32_t>& targets) {
+        const CsrGraph& g = graph();
+        lastSearchStats = SearchStats();
+        DistanceMatrix matrix;
+        matrix.rows = static_cast<uint32_t>(sources.size());
+        matrix.cols = static_cast<uint32_t>(targets.size());
+
+        if (searchMode == SearchMode::ContractionHierarchy) {
+            hierarchy().manyToMany(sources, targets, matrix.values, lastSearchStats);
+            return matrix;
+        }
+
+        uint32_t n = g.nodeCount();
+        SearchContext& targetMarks = threadSearchWorkspace().marks;
+        targetMarks.begin(n);
+        uint32_t targetCount = 0;
+        for (uint32_t t : targets) {
+            if (t < n && targetMarks.distance(t) == INT_MAX) {
+                targetMarks.update(t, 0, LocationTable::npos);
+                ++targetCount;
+            }
+        }
+
+        // Rows are independent searches, so larger matrices spread them over the worker pool.
+        matrix.values.assign(static_cast<size_t>(matrix.rows) * matrix.cols, INT_MAX);
+        auto fillRow = [&](uint32_t row, SearchStats& stats) {
+            if (sources[row] >= n) return;
+            int* rowValues = matrix.values.data() + static_cast<size_t>(row) * matrix.cols;
+            withFrontiers(frontierKind, [&](auto& frontiers) {
+                oneToMany(g, sources[row], targetMarks, targetCount, targets.data(), targets.size(), rowValues, frontiers[0], stats);
+            });
+        };
+        if (matrix.rows < 8) {
+            for (uint32_t row = 0; row < matrix.rows; ++row) fillRow(row, lastSearchStats);
+            return matrix;
+        }
+        ThreadPool& pool = workers();
+        vector<SearchStats> workerStats(pool.size());
+        pool.parallelFor(matrix.rows, [&](size_t row, unsigned worker) {
+            fillRow(static_cast<uint32_t>(row), workerStats[worker]);
+        });
+        for (const SearchStats& stats : workerStats) {
+            lastSearchStats.nodesSettled += stats.nodesSettled;
+            lastSearchStats.edgesRelaxed += stats.edgesRelaxed;
+        }
+        return matrix;
+    }
+
+    PathResult findShortestPath(uint32_t start, uint32_t end) {
+        const CsrGraph& g = graph();
+        lastSearchStats = SearchStats();
+        if (start >= g.nodeCount() || end >= g.nodeCount()) return PathResult();
+
+        switch (searchMode) {
+            case SearchMode::Bidirectional:
+                return withFrontiers(frontierKind, [&](auto& frontiers) { return bidirectionalSearch(g, start, end, frontiers); });
+            case SearchMode::AStar: {
+                // A* keys are not monotone under an inconsistent heuristic, which the radix heap cannot take.
+                FrontierKind kind = frontierKind == FrontierKind::RadixHeap ? FrontierKind::BinaryHeap : frontierKind;
+                return withFrontiers(kind, [&](auto& frontiers) { return aStarSearch(g, start, end, frontiers[0]); });
+            }
+            case SearchMode::ContractionHierarchy: return hierarchy().path(start, end, lastSearchStats);
+            case SearchMode::Overlay: return overlay().path(g, start, end, lastSearchStats);
+            case SearchMode::Dijkstra: break;
+        }
+        return withFrontiers(frontierKind, [&](auto& frontiers) { return dijkstraSearch(g, start, end, frontiers[0]); });
     }
 
 public:
+    // pendingCapacity bounds the lock-free intake queue; placeOrder fails once it is full.
+    explicit FoodDeliverySystem(size_t pendingCapacity = 1 << 16) : incomingOrders(pendingCapacity) {}
+
+    vector<string> locationNames(const vector<uint32_t>& ids) const {
+        vector<string> names;
+        names.reserve(ids.size());
+        for (uint32_t id : ids) {
+            names.emplace_back(locations.name(id));
+        }
+        return names;
+    }
+
+    // Distance and node ids from a single search; withLegs adds the per-hop weights, one
+    // adjacency scan per hop on the frozen graph.
+    PathResult shortestPath(const string& start, const string& end, bool withLegs = false) {
+        ScopedLatency latency(metricsRegistry, MetricTimer::FindShortestPath);
+        uint32_t from = locations.find(start);
+        uint32_t to = locations.find(end);
+        if (from == LocationTable::npos || to == LocationTable::npos) return PathResult();
+        PathResult result = findShortestPath(from, to);
+        recordSearch();
+        if (withLegs && result.nodes.size() > 1) {
+            const CsrGraph& g = graph();
+            result.legs.reserve(result.nodes.size() - 1);
+            for (size_t i = 0; i + 1 < result.nodes.size(); ++i) {
+                result.legs.push_back(g.edgeWeight(result.nodes[i], result.nodes[i + 1]));
+            }
+        }
+        return result;
+    }
+
+    vector<string> findShortestPath(const string& start, const string& end) {
+        return locationNames(shortestPath(start, end).nodes);
+    }
+
+    // Makes staged route edits visible to snapshotPath as one new version and frees the
+    // versions no reader holds any more. Edits are otherwise published by the next query.
+    uint64_t publishRoutes() {
+        graph();
+        graphVersions.reclaim();
+        return graphVersion;
+    }
+
+    // Safe from any thread, also while another thread edits and publishes routes: the search
+    // runs on the version published when it started and never waits for the writer. Ids are
+    // as of that version; version, if given, receives it. Dijkstra regardless of the mode.
+    PathResult snapshotPath(uint32_t start, uint32_t end, uint64_t* version = nullptr) {
+        GraphVersions::Reader snapshot(graphVersions);
+        if (version) *version = snapshot->version;
+        const CsrGraph& g = snapshot->graph;
+        PathResult result;
+        if (start < g.nodeCount() && end < g.nodeCount()) routeLeg(g, start, end, result.distance, result.nodes);
+        return result;
+    }
+
+    // Fastest path leaving start at `departure` seconds after midnight (later days wrap), with
+    // distance and legs in seconds: each edge at SchedulerOptions::secondsPerKm free flow, scaled
+    // by its profile when it is entered. A* in SearchMode::AStar, Dijkstra otherwise.
+    PathResult fastestPath(const string& start, const string& end, uint32_t departure) {
+        ScopedLatency latency(metricsRegistry, MetricTimer::FindShortestPath);
+        uint32_t from = locations.find(start);
+        uint32_t to = locations.find(end);
+        if (from == LocationTable::npos || to == LocationTable::npos) return PathResult();
+        const TravelProfiles& travel = profiles();
+        const CsrGraph& g = graph();
+        lastSearchStats = SearchStats();
+        bool goalDirected = searchMode == SearchMode::AStar;
+        FrontierKind kind = goalDirected && frontierKind == FrontierKind::RadixHeap ? FrontierKind::BinaryHeap : frontierKind;
+        PathResult result = withFrontiers(kind, [&](auto& frontiers) {
+            return timeDependentSearch(g, travel, from, to, departure, goalDirected, frontiers[0]);
+        });
+        recordSearch();
+        return result;
+    }
+
+    // Time-of-day slowdown for the route between start and end, both directions. The factors
+    // spread evenly over the day (96: one per quarter hour, 24: one per hour, 1: all day) and
+    // multiply the free-flow time, from 1/32 to about 8 in 1/32 steps. Empty factors clear it.
+    Status setRouteProfile(const string& start, const string& end, const vector<double>& factors) {
+        uint32_t from = locations.find(start);
+        uint32_t to = locations.find(end);
+        if (from == LocationTable::npos || to == LocationTable::npos) return Status::UnknownLocation;
+        if (graph().edgeIndex(from, to) == UINT32_MAX) return Status::RouteNotFound;
+        uint32_t profile = 0;
+        if (!factors.empty()) {
+            if (factors.size() > TravelProfiles::slotsPerDay || TravelProfiles::slotsPerDay % factors.size()) return Status::InvalidProfile;
+            vector<uint8_t> slots;
+            for (double factor : factors) {
+                long long steps = llround(factor * TravelProfiles::freeFlow);
+                if (!(factor > 0) || steps < 1 || steps > 255) return Status::InvalidProfile;
+                slots.insert(slots.end(), TravelProfiles::slotsPerDay / factors.size(), static_cast<uint8_t>(steps));
+            }
+            profile = travelProfiles.intern(slots);
+        }
+        for (uint64_t key : {static_cast<uint64_t>(from) << 32 | to, static_cast<uint64_t>(to) << 32 | from}) {
+            if (profile) routeProfiles[key] = profile;
+            else routeProfiles.erase(key);
+        }
+        profilesVersion = UINT64_MAX;
+        return Status::Ok;
+    }
+
+    // Distance-only query: reuses the thread's search workspace and allocates nothing in steady state.
+    int shortestDistance(const string& start, const string& end) {
+        uint32_t from = locations.find(start);
+        uint32_t to = locations.find(end);
+        const CsrGraph& g = graph();
+        lastSearchStats = SearchStats();
+        if (from >= g.nodeCount() || to >= g.nodeCount()) return INT_MAX;
+        int distance;
+        if (searchMode == SearchMode::ContractionHierarchy || searchMode == SearchMode::Overlay) {
+            distance = searchMode == SearchMode::Overlay ? overlay().distance(g, from, to, lastSearchStats)
+                                                         : hierarchy().distance(from, to, lastSearchStats);
+            recordSearch();
+            return distance;
+        }
+
+        DistanceLabels& labels = threadSearchWorkspace().distances;
+        withFrontiers(frontierKind, [&](auto& frontiers) {
+            labelSetting(g, StaticWeights{g}, labels, NoBound(), from, to, frontiers[0], lastSearchStats);
+        });
+        recordSearch();
+        return labels.distance(to);
+    }
+
+    // All-pairs distances in one pass; unknown names produce INT_MAX rows or columns.
+    DistanceMatrix distanceMatrix(const vector<string>& sources, const vector<string>& targets) {
+        vector<uint32_t> sourceIds, targetIds;
+        for (const string& name : sources) sourceIds.push_back(locations.find(name));
+        for (const string& name : targets) targetIds.push_back(locations.find(name));
+        DistanceMatrix matrix = distanceMatrix(sourceIds, targetIds);
+        recordSearch();
+        return matrix;
+    }
+
     
-    void addLocation(const string& name) {
-        if (deliveryGraph.find(name) == deliveryGraph.end()) {
-            deliveryGraph[name] = {};
-            cout << "Location added: " << name << endl;
-        } else {
-            cout << "Location " << name << " already exists." << endl;
+    // AlreadyExists leaves the location untouched.
+    Status addLocation(const string& name) {
+        bool inserted;
+        uint32_t id = internLocation(name, inserted);
+        if (!inserted) return Status::AlreadyExists;
+        if (eventLog.enabled()) {
+            string fields = ",\"id\":" + to_string(id) + ",\"name\":";
+            writeJsonString(fields, name);
+            eventLog.write("location_added", fields);
         }
+        return Status::Ok;
+    }
+
+    Status addLocation(const string& name, double latitude, double longitude) {
+        Status status = addLocation(name);
+        if (status == Status::Ok) locations.setCoordinates(locations.find(name), latitude, longitude);
+        return status;
+    }
+
+    void setSearchMode(SearchMode mode) { searchMode = mode; }
+
+    // Target locations per region of the SearchMode::Overlay partition; re-partitions on next use.
+    void setRegionSize(uint32_t locationsPerRegion) {
+        regionSize = max(locationsPerRegion, 1u);
+        regionOverlay = RegionOverlay();
+    }
+
+    uint32_t regionCount() { return overlay().regionCount(); }
+
+    // Region owning a location, or npos for an unknown name.
+    uint32_t regionOf(const string& name) {
+        uint32_t id = locations.find(name);
+        const RegionOverlay& regions = overlay();
+        return id < regions.nodeCount() ? regions.regionOf(id) : LocationTable::npos;
     }
 
+    // Byte budget of the delivery-leg cache (16 MB by default); 0 turns it off.
+    void setRouteCacheBytes(size_t bytes) { routeCache.setCapacity(bytes); }
+
+    // Frontier used by the Dijkstra-based searches, trees and distance matrices.
+    void setFrontier(FrontierKind kind) { frontierKind = kind; }
+
+    // Overrides the built-in haversine estimate used by SearchMode::AStar.
+    void setSearchHeuristic(SearchHeuristic heuristic) { searchHeuristic = move(heuristic); }
+
+    const SearchStats& lastSearch() const { return lastSearchStats; }
+
     
-    void addRoute(const string& start, const string& end, int distance) {
-        if (deliveryGraph.count(start) && deliveryGraph.count(end)) {
-            
-            deliveryGraph[start][end] = distance;
-            deliveryGraph[end][start] = distance;
-            cout << "Route added: " << start << " <-> " << end << " (" << distance << " km)" << endl;
-        } else {
-            cout << "Error: One or both locations do not exist. Add them first." << endl;
+    Status addRoute(const string& start, const string& end, int distance) {
+        // Every search here settles nodes in distance order, which negative weights would break.
+        if (distance < 0) return Status::InvalidDistance;
+        uint32_t from = locations.find(start);
+        uint32_t to = locations.find(end);
+        if (from == LocationTable::npos || to == LocationTable::npos) return Status::UnknownLocation;
+        connect(from, to, distance);
+        logRouteAdded(from, to, distance);
+        return Status::Ok;
+    }
+
+    // Applies many route changes (e.g. a traffic update) with a single repair pass per cached
+    // tree. Statuses line up with routes; failed entries are skipped.
+    vector<Status> addRoutes(const vector<Route>& routes) {
+        vector<Status> statuses;
+        vector<EdgeChange> changes;
+        for (const Route& route : routes) {
+            uint32_t from = locations.find(route.start);
+            uint32_t to = locations.find(route.end);
+            if (route.distance < 0) {
+                statuses.push_back(Status::InvalidDistance);
+            } else if (from == LocationTable::npos || to == LocationTable::npos) {
+                statuses.push_back(Status::UnknownLocation);
+            } else {
+                stageRoute(from, to, route.distance, changes);
+                logRouteAdded(from, to, route.distance);
+                statuses.push_back(Status::Ok);
+            }
+        }
+        repairPathTrees(changes);
+        return statuses;
+    }
+
+    // Writes the current network as a snapshot that loadNetwork can map in place.
+    NetworkFileResult saveNetwork(const string& path) {
+        const CsrGraph& g = graph();
+        uint32_t n = g.nodeCount();
+        NetworkFileResult result;
+
+        vector<uint32_t> nameIndex(n + 1, 0);
+        string nameBlob;
+        for (uint32_t id = 0; id < n; ++id) {
+            nameBlob.append(locations.name(id));
+            if (nameBlob.size() > UINT32_MAX) {
+                result.status = Status::InvalidFile;
+                return result;
+            }
+            nameIndex[id + 1] = static_cast<uint32_t>(nameBlob.size());
+        }
+        vector<uint32_t> sorted(n);
+        for (uint32_t id = 0; id < n; ++id) sorted[id] = id;
+        sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return locations.name(a) < locations.name(b); });
+        vector<double> coordinates(2 * static_cast<size_t>(n), numeric_limits<double>::quiet_NaN());
+        for (uint32_t id = 0; id < n; ++id) {
+            double latitude, longitude;
+            if (locations.coordinates(id, latitude, longitude)) {
+                coordinates[2 * id] = latitude;
+                coordinates[2 * id + 1] = longitude;
+            }
+        }
+        vector<uint32_t> offsets(n + 1);
+        for (uint32_t u = 0; u <= n; ++u) offsets[u] = u < n ? g.edgeBegin(u) : g.edgeCount();
+        vector<uint32_t> targets(g.edgeCount());
+        vector<int> weights(g.edgeCount());
+        for (uint32_t e = 0; e < g.edgeCount(); ++e) {
+            targets[e] = g.target(e);
+            weights[e] = g.weight(e);
+        }
+
+        NetworkFileHeader header = {};
+        memcpy(header.magic, networkFileMagic, sizeof(header.magic));
+        header.version = NetworkFileHeader::currentVersion;
+        header.byteOrder = NetworkFileHeader::byteOrderMark;
+        header.nodeCount = n;
+        header.edgeCount = g.edgeCount();
+        header.nameBytes = nameBlob.size();
+        uint64_t cursor = sizeof(header);
+        auto place = [&](uint64_t bytes) {
+            uint64_t at = cursor;
+            cursor = (cursor + bytes + 7) & ~uint64_t(7);
+            return at;
+        };
+        header.offsetsAt = place(offsets.size() * sizeof(uint32_t));
+        header.targetsAt = place(targets.size() * sizeof(uint32_t));
+        header.weightsAt = place(weights.size() * sizeof(int));
+        header.coordinatesAt = place(coordinates.size() * sizeof(double));
+        header.nameIndexAt = place(nameIndex.size() * sizeof(uint32_t));
+        header.sortedAt = place(sorted.size() * sizeof(uint32_t));
+        header.namesAt = place(nameBlob.size());
+        header.fileSize = cursor;
+
+        ofstream out(path, ios::binary | ios::trunc);
+        uint64_t written = 0;
+        auto section = [&](uint64_t at, const void* data, uint64_t bytes) {
+            static const char padding[8] = {};
+            out.write(padding, static_cast<streamsize>(at - written));
+            out.write(static_cast<const char*>(data), static_cast<streamsize>(bytes));
+            written = at + bytes;
+        };
+        section(0, &header, sizeof(header));
+        section(header.offsetsAt, offsets.data(), offsets.size() * sizeof(uint32_t));
+        section(header.targetsAt, targets.data(), targets.size() * sizeof(uint32_t));
+        section(header.weightsAt, weights.data(), weights.size() * sizeof(int));
+        section(header.coordinatesAt, coordinates.data(), coordinates.size() * sizeof(double));
+        section(header.nameIndexAt, nameIndex.data(), nameIndex.size() * sizeof(uint32_t));
+        section(header.sortedAt, sorted.data(), sorted.size() * sizeof(uint32_t));
+        section(header.namesAt, nameBlob.data(), nameBlob.size());
+        section(header.fileSize, nullptr, 0);
+        out.flush();
+        if (!out) {
+            result.status = Status::FileError;
+            result.detail = "cannot write " + path;
+            return result;
+        }
+        result.locations = n;
+        result.directedEdges = g.edgeCount();
+        return result;
+    }
+
+    // Maps a snapshot written by saveNetwork and routes on it directly; nothing is parsed or
+    // rebuilt until the network is edited. Pending orders and cached trees would refer to the
+    // old ids, so this only works on an empty system.
+    NetworkFileResult loadNetwork(const string& path) {
+        NetworkFileResult result;
+        if (locations.size() != 0) {
+            result.status = Status::NetworkNotEmpty;
+            return result;
         }
+        shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->open(path, result.detail)) {
+            result.status = Status::FileError;
+            return result;
+        }
+        NetworkFileHeader header;
+        if (!validNetworkFile(*file, header)) {
+            result.status = Status::InvalidFile;
+            return result;
+        }
+
+        char* base = file->data();
+        locations.attach(header.nodeCount, reinterpret_cast<const uint32_t*>(base + header.nameIndexAt), base + header.namesAt,
+                         reinterpret_cast<const uint32_t*>(base + header.sortedAt),
+                         reinterpret_cast<double*>(base + header.coordinatesAt));
+        unique_ptr<GraphSnapshot> snapshot(new GraphSnapshot());
+        snapshot->graph.adopt(header.nodeCount, reinterpret_cast<const uint32_t*>(base + header.offsetsAt),
+                              reinterpret_cast<const uint32_t*>(base + header.targetsAt),
+                              reinterpret_cast<const int*>(base + header.weightsAt));
+        snapshot->version = ++graphVersion;
+        snapshot->file = file;
+        graphVersions.publish(move(snapshot));
+        stagedRoutes.clear();
+        routesStaged = false;
+        graphDirty = false;
+        pathTrees.clear();
+        routeCache.invalidate();
+        networkFile = move(file);
+        result.locations = header.nodeCount;
+        result.directedEdges = header.edgeCount;
+        return result;
+    }
+
+    // Bulk-loads routes from a CSV edge list: "from,to,distance" per line, optionally followed
+    // by "from_lat,from_lon,to_lat,to_lon" as exported by OSM tooling. Unknown names become
+    // locations. Blank lines, '#' comments and a header row are skipped; other bad lines are
+    // counted in the result.
+    NetworkFileResult importRoutesCsv(const string& path) {
+        NetworkFileResult result;
+        ifstream in(path);
+        if (!in) {
+            result.status = Status::FileError;
+            result.detail = "cannot open " + path;
+            return result;
+        }
+        size_t lineNumber = 0;
+        bool sawData = false;
+        string line;
+        vector<string> fields;
+        while (getline(in, line)) {
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+
+            fields.clear();
+            size_t begin = 0;
+            while (true) {
+                size_t comma = line.find(',', begin);
+                string field = line.substr(begin, comma == string::npos ? string::npos : comma - begin);
+                size_t first = field.find_first_not_of(" \t");
+                size_t last = field.find_last_not_of(" \t");
+                fields.push_back(first == string::npos ? string() : field.substr(first, last - first + 1));
+                if (comma == string::npos) break;
+                begin = comma + 1;
+            }
+
+            bool valid = (fields.size() == 3 || fields.size() == 7) && !fields[0].empty() && !fields[1].empty();
+            char* end = nullptr;
+            long distance = valid ? strtol(fields[2].c_str(), &end, 10) : -1;
+            valid = valid && end != fields[2].c_str() && *end == '\0' && distance >= 0 && distance <= INT_MAX;
+            double coordinates[4];
+            for (size_t c = 0; valid && fields.size() == 7 && c < 4; ++c) {
+                coordinates[c] = strtod(fields[3 + c].c_str(), &end);
+                valid = end != fields[3 + c].c_str() && *end == '\0';
+            }
+            if (!valid) {
+                if (!sawData) {
+                    sawData = true;  // header row
+                    continue;
+                }
+                if (result.malformedLines++ == 0) result.firstMalformedLine = lineNumber;
+                continue;
+            }
+            sawData = true;
+
+            bool inserted;
+            uint32_t from = internLocation(fields[0], inserted);
+            uint32_t to = internLocation(fields[1], inserted);
+            if (fields.size() == 7) {
+                locations.setCoordinates(from, coordinates[0], coordinates[1]);
+                locations.setCoordinates(to, coordinates[2], coordinates[3]);
+            }
+            connect(from, to, static_cast<int>(distance));
+            ++result.routesImported;
+        }
+        result.locations = locations.size();
+        return result;
+    }
+
+    // Renumbers locations so that road neighbours get nearby ids, which keeps the CSR rows and
+    // the per-node search arrays they index close together in memory. Names keep working and
+    // couriers follow their locations, but any id handed out before (including those a custom
+    // search heuristic was written against) is stale afterwards, and orders and the journal
+    // record ids, so, like loadNetwork, this only runs before the first order. Saving the
+    // network afterwards keeps the order, so large networks only pay for it once.
+    Status reorderLocations(NodeOrder method = NodeOrder::Auto) {
+        if (allOrders.nextId() != OrderSlab::firstOrderId || journal.enabled()) return Status::OrdersNotEmpty;
+        const CsrGraph& g = graph();
+        uint32_t n = g.nodeCount();
+        vector<uint32_t> order = localityOrder(g, locations, method);
+        vector<uint32_t> renamed(n);
+        for (uint32_t id = 0; id < n; ++id) renamed[order[id]] = id;
+
+        LocationTable reordered;
+        vector<vector<pair<uint32_t, int>>> routes(n);
+        for (uint32_t id = 0; id < n; ++id) {
+            uint32_t old = order[id];
+            bool inserted;
+            reordered.intern(string(locations.name(old)), inserted);
+            double latitude, longitude;
+            if (locations.coordinates(old, latitude, longitude)) reordered.setCoordinates(id, latitude, longitude);
+            routes[id].reserve(g.edgeEnd(old) - g.edgeBegin(old));
+            for (uint32_t e = g.edgeBegin(old); e < g.edgeEnd(old); ++e) routes[id].push_back({renamed[g.target(e)], g.weight(e)});
+        }
+        unordered_map<uint64_t, uint32_t> remapped;
+        remapped.reserve(routeProfiles.size());
+        for (const auto& entry : routeProfiles) {
+            uint64_t from = renamed[entry.first >> 32], to = renamed[entry.first & UINT32_MAX];
+            remapped.emplace(from << 32 | to, entry.second);
+        }
+
+        locations = move(reordered);
+        stagedRoutes = move(routes);
+        routeProfiles = move(remapped);
+        routesStaged = true;
+        graphDirty = true;
+        graph();
+        networkFile.reset();  // only retired versions still point into the file, and they hold it
+        profilesVersion = UINT64_MAX;
+        contractionHierarchy = ContractionHierarchy();  // its contraction order is by old id
+        regionOverlay = RegionOverlay();
+        pathTrees.clear();
+        routeCache.invalidate();
+        locationGridVersion = UINT64_MAX;
+        for (Courier& courier : couriers) courier.location = renamed[courier.location];  // the grid keys on coordinates
+        if (eventLog.enabled()) {
+            eventLog.write("locations_reordered", string(",\"method\":\"") + (method == NodeOrder::Hilbert ? "hilbert" : "cuthill_mckee") + "\"");
+        }
+        return Status::Ok;
     }
 
     
-    void placeOrder(const string& restaurant, const string& destination, double price) {
-        if (deliveryGraph.count(restaurant) && deliveryGraph.count(destination)) {
-            Order newOrder = {nextOrderId++, restaurant, destination, price};
-            incomingOrders.push(newOrder); 
-            allOrders[newOrder.id] = newOrder;
-            cout << "New Order Placed (ID: " << newOrder.id << "): " << newOrder.restaurant << " -> " << newOrder.destination << endl;
-        } else {
-            cout << "Error: Restaurant or destination location does not exist in the map." << endl;
+    // slaSeconds is the promised delivery time from now; 0 takes the scheduler's default.
+    OrderResult placeOrder(const string& restaurant, const string& destination, double price, uint32_t slaSeconds = 0) {
+        OrderResult result;
+        uint32_t restaurantId = locations.find(restaurant);
+        uint32_t destinationId = locations.find(destination);
+        MetricsShard& metrics = metricsRegistry.local();
+        if (restaurantId == LocationTable::npos || destinationId == LocationTable::npos) {
+            metrics.add(MetricCounter::OrdersRejected);
+            result.status = Status::UnknownLocation;
+            return result;
+        }
+        uint32_t handle = allOrders.allocate();
+        if (handle == OrderSlab::npos) {
+            metrics.add(MetricCounter::OrdersRejected);
+            result.status = Status::OrderIdsExhausted;
+            return result;
         }
+        uint32_t now = schedulerNow();
+        Order newOrder = {OrderSlab::idFor(handle), restaurantId, destinationId, price, now,
+                          now + (slaSeconds ? slaSeconds : schedulerOptions.defaultSlaSeconds)};
+        allOrders.publish(handle, newOrder);
+        if (journal.enabled()) journal.append(JournalEvent::Placed, newOrder);
+        if (!incomingOrders.push(handle, dispatchKey(newOrder))) {
+            if (journal.enabled()) journal.append(JournalEvent::Rejected, newOrder);
+            allOrders.retire(handle);
+            metrics.add(MetricCounter::OrdersRejected);
+            result.status = Status::QueueFull;
+            return result;
+        }
+        metrics.add(MetricCounter::OrdersPlaced);
+        metrics.raise(MetricHighWater::PendingOrders, incomingOrders.size());
+        result.order = newOrder;
+        logOrder("order_placed", newOrder);
+        return result;
     }
 
   
-    void processNextOrder() {
-        if (incomingOrders.empty()) {
-            cout << "No pending orders in the queue." << endl;
-            return;
+    OrderResult processNextOrder() {
+        OrderResult result;
+        uint32_t handle;
+        if (!incomingOrders.pop(handle)) {
+            result.status = Status::QueueEmpty;
+            return result;
+        }
+        result.order = allOrders.at(handle);
+        size_t completed;
+        {
+            lock_guard<mutex> guard(completedLock);
+            if (journal.enabled()) journal.append(JournalEvent::Processed, result.order);
+            completedOrders.push_back(handle);
+            trimCompletedWindow();
+            completed = completedOrders.size();
+        }
+        MetricsShard& metrics = metricsRegistry.local();
+        metrics.add(MetricCounter::OrdersProcessed);
+        metrics.raise(MetricHighWater::CompletedDeliveries, completed);
+        logOrder("order_delivered", result.order);
+        return result;
+    }
+
+  
+    OrderResult lastDelivery() const {
+        OrderResult result;
+        lock_guard<mutex> guard(completedLock);
+        if (completedOrders.empty()) {
+            result.status = Status::NoCompletedDeliveries;
+            return result;
+        }
+        result.order = allOrders.at(completedOrders.back());
+        return result;
+    }
+
+    
+    // Pending orders in the order processNextOrder would take them.
+    vector<Order> pendingOrders() const {
+        vector<Order> orders;
+        forEachPendingOrder([&](const Order& order) { orders.push_back(order); });
+        return orders;
+    }
+
+    // Same order as pendingOrders(), visited in place. visit must not place or process orders.
+    template <typename Visit>
+    void forEachPendingOrder(Visit visit) const {
+        incomingOrders.forEach([&](uint32_t handle) { visit(allOrders.at(handle)); });
+    }
+
+    // Switching re-queues the pending orders under the new policy. Call it while no other thread
+    // is placing or processing orders.
+    void setScheduler(const SchedulerOptions& options) {
+        vector<uint32_t> pending;
+        uint32_t handle;
+        while (incomingOrders.pop(handle)) pending.push_back(handle);
+        schedulerOptions = options;
+        incomingOrders.setPolicy(options.policy);
+        for (uint32_t requeued : pending) incomingOrders.push(requeued, dispatchKey(allOrders.at(requeued)));
+    }
+
+    const SchedulerOptions& scheduler() const { return schedulerOptions; }
+
+    CourierResult addCourier(const string& location) {
+        CourierResult result;
+        uint32_t id = locations.find(location);
+        if (id == LocationTable::npos) {
+            result.status = Status::UnknownLocation;
+            return result;
+        }
+        couriers.push_back({static_cast<int>(couriers.size()) + 1, id, true});
+        placeCourier(couriers.back());
+        result.courier = couriers.back();
+        return result;
+    }
+
+    CourierResult moveCourier(int courierId, const string& location) {
+        return moveCourier(courierId, locations.find(location));
+    }
+
+    // Snaps a raw position to the closest location that has coordinates.
+    CourierResult moveCourier(int courierId, double latitude, double longitude) {
+        return moveCourier(courierId, nearestLocation(latitude, longitude));
+    }
+
+    CourierResult moveCourier(int courierId, uint32_t location) {
+        CourierResult result;
+        Courier* courier = findCourier(courierId);
+        if (!courier) result.status = Status::CourierNotFound;
+        else if (location >= locations.size()) result.status = Status::UnknownLocation;
+        if (result.status != Status::Ok) return result;
+        courier->location = location;
+        placeCourier(*courier);
+        result.courier = *courier;
+        return result;
+    }
+
+    // Unavailable couriers stay indexed but are never offered.
+    Status setCourierAvailable(int courierId, bool available) {
+        Courier* courier = findCourier(courierId);
+        if (!courier) return Status::CourierNotFound;
+        courier->available = available;
+        return Status::Ok;
+    }
+
+    size_t courierCount() const { return couriers.size(); }
+
+    // Courier updates and queries run on the thread that owns the system.
+    vector<CourierDistance> nearestCouriers(const string& location, size_t k) {
+        vector<CourierDistance> nearest;
+        uint32_t origin = locations.find(location);
+        if (origin != LocationTable::npos) nearestCouriers(graph(), origin, k, nearest);
+        return nearest;
+    }
+
+    // How many completed deliveries stay in memory for lastDelivery and revertLastDelivery.
+    void setCompletedWindow(size_t window) {
+        lock_guard<mutex> guard(completedLock);
+        completedWindow = max<size_t>(window, 1);
+        trimCompletedWindow();
+    }
+
+    // Replays the journal at path into an empty order book, rewrites it with only the live
+    // orders (pending plus the completed window), then appends every later order event to it.
+    // Location ids are taken as-is, so the network has to be loaded first.
+    JournalResult openJournal(const string& path, const JournalOptions& options = JournalOptions()) {
+        JournalResult result;
+        if (allOrders.nextId() != OrderSlab::firstOrderId || journal.enabled()) {
+            result.status = Status::OrdersNotEmpty;
+            return result;
+        }
+        vector<JournalRecord> records;
+        size_t validBytes, fileBytes;
+        if (!OrderJournal::read(path, records, validBytes, fileBytes, result.detail)) {
+            result.status = Status::InvalidFile;
+            return result;
+        }
+        result.records = records.size();
+        result.discardedBytes = fileBytes - validBytes;
+
+        // Pending orders keep their journal order; reverted ones rejoin at the back.
+        vector<uint32_t> pending;
+        unordered_map<uint32_t, size_t> pendingAt;
+        deque<uint32_t> completed;
+        vector<uint8_t> journaled;     // by slot; retired slots are no longer published()
+        auto leavePending = [&](uint32_t handle) {
+            auto it = pendingAt.find(handle);
+            if (it == pendingAt.end()) return false;
+            pending[it->second] = LocationTable::npos;
+            pendingAt.erase(it);
+            return true;
+        };
+        for (const JournalRecord& record : records) {
+            const Order& order = record.order;
+            JournalEvent event = static_cast<JournalEvent>(record.event);
+            // Slots past OrderSlab::capacity() do not exist; the next id may sit just past the last one.
+            uint32_t slot = order.id > OrderSlab::firstOrderId ? static_cast<uint32_t>(order.id - OrderSlab::firstOrderId) : 0;
+            if (slot > OrderSlab::capacity() || (event != JournalEvent::NextId && slot == OrderSlab::capacity())) {
+                result.status = Status::InvalidFile;
+                result.detail = "order id " + to_string(order.id) + " is beyond the order table";
+                return result;
+            }
+            if (event == JournalEvent::NextId) {
+                if (slot > 0) allOrders.reserveThrough(slot);
+                continue;
+            }
+            if (order.id < OrderSlab::firstOrderId || order.restaurant >= locations.size() || order.destination >= locations.size()) {
+                result.status = Status::InvalidFile;
+                result.detail = "order " + to_string(order.id) + " refers to a location outside the loaded network";
+                return result;
+            }
+            uint32_t handle = static_cast<uint32_t>(order.id - OrderSlab::firstOrderId);
+            if (event == JournalEvent::Placed) {
+                allOrders.restore(handle, order);
+                if (handle >= journaled.size()) journaled.resize(handle + 1);
+                journaled[handle] = 1;
+                pendingAt[handle] = pending.size();
+                pending.push_back(handle);
+            } else if (event == JournalEvent::Rejected) {
+                if (leavePending(handle)) allOrders.retire(handle);
+            } else if (event == JournalEvent::Processed) {
+                if (!leavePending(handle)) continue;
+                completed.push_back(handle);
+                if (completed.size() > completedWindow) {
+                    allOrders.retire(completed.front());
+                    completed.pop_front();
+                }
+            } else if (event == JournalEvent::Reverted) {
+                auto it = find(completed.rbegin(), completed.rend(), handle);
+                if (it == completed.rend()) continue;
+                completed.erase(next(it).base());
+                pendingAt[handle] = pending.size();
+                pending.push_back(handle);
+            }
+        }
+        // Slots that were allocated but never journaled can never be referenced.
+        uint32_t nextSlot = static_cast<uint32_t>(allOrders.nextId() - OrderSlab::firstOrderId);
+        for (uint32_t handle = 0; handle < nextSlot; ++handle) {
+            if (handle >= journaled.size() || !journaled[handle]) allOrders.retire(handle);
+        }
+
+        vector<JournalRecord> live;
+        live.reserve(1 + 2 * completed.size() + pendingAt.size());
+        auto keep = [&](JournalEvent event, uint32_t handle) {
+            JournalRecord record = {};
+            record.event = static_cast<uint8_t>(event);
+            record.order = allOrders.at(handle);
+            record.checksum = JournalRecord::checksumOf(record);
+            live.push_back(record);
+        };
+        JournalRecord watermark = {};
+        watermark.event = static_cast<uint8_t>(JournalEvent::NextId);
+        watermark.order.id = allOrders.nextId();
+        watermark.checksum = JournalRecord::checksumOf(watermark);
+        live.push_back(watermark);
+        for (uint32_t handle : completed) {
+            keep(JournalEvent::Placed, handle);
+            keep(JournalEvent::Processed, handle);
+        }
+        for (uint32_t handle : pending) {
+            if (handle == LocationTable::npos) continue;
+            keep(JournalEvent::Placed, handle);
+            if (!incomingOrders.push(handle, dispatchKey(allOrders.at(handle)))) {
+                result.status = Status::QueueFull;
+                return result;
+            }
+        }
+        {
+            lock_guard<mutex> guard(completedLock);
+            completedOrders = move(completed);
+            result.completedDeliveries = completedOrders.size();
+        }
+        result.pendingOrders = incomingOrders.size();
+
+        bool compact = live.size() < records.size() || validBytes < fileBytes;
+        if (fileBytes > 0 && compact && !OrderJournal::rewrite(path, live, result.detail)) {
+            result.status = Status::FileError;
+            return result;
+        }
+        if (!journal.open(path, options, result.detail)) result.status = Status::FileError;
+        return result;
+    }
+
+    // Blocks until every order event so far is on disk; FileError once a journal write has failed.
+    Status flushJournal() { return journal.flush() ? Status::Ok : Status::FileError; }
+
+   
+    DeliveryRoute optimizeDeliveryRoute(int orderId) {
+        ScopedLatency latency(metricsRegistry, MetricTimer::OptimizeDeliveryRoute);
+        DeliveryRoute route;
+        route.orderId = orderId;
+        uint32_t handle;
+        if (!allOrders.find(orderId, handle)) return route;
+        const Order& order = allOrders.at(handle);
+
+        string depot = "Depot"; 
+
+        // Registered couriers replace the Depot as the agent's starting point.
+        if (couriers.empty() && !locations.contains(depot)) {
+            route.status = Status::DepotMissing;
+            return route;
+        }
+
+        uint32_t restaurantId = order.restaurant;
+        uint32_t destinationId = order.destination;
+
+        route.status = Status::Ok;
+       
+        if (couriers.empty()) {
+            const ShortestPathTree& depotTree = shortestPathTree(locations.find(depot));
+            route.agentDistance = depotTree.distanceTo(restaurantId);
+            route.agentPath = depotTree.pathTo(restaurantId);
+        }
+
+        // Couriers are reached through the restaurant's tree; without them a cached tree is
+        // used when there is one, and a point-to-point search otherwise.
+        uint64_t generation = routeCache.generation();
+        const ShortestPathTree* restaurantTree = nullptr;
+        if (!couriers.empty()) {
+            restaurantTree = &shortestPathTree(restaurantId);
+        } else {
+            auto it = pathTrees.find(restaurantId);
+            if (it != pathTrees.end()) restaurantTree = &it->second;
+        }
+        if (!cachedDeliveryLeg(restaurantId, destinationId, route)) {
+            if (restaurantTree) {
+                route.deliveryDistance = restaurantTree->distanceTo(destinationId);
+                route.deliveryPath = restaurantTree->pathTo(destinationId);
+            } else {
+                PathResult leg = findShortestPath(restaurantId, destinationId);
+                recordSearch();
+                route.deliveryDistance = leg.distance;
+                route.deliveryPath = move(leg.nodes);
+            }
+            routeCache.insert(restaurantId, destinationId, generation, route.deliveryDistance, route.deliveryPath);
+        }
+        if (!couriers.empty()) assignNearestCourier(graph(), restaurantId, *restaurantTree, route);
+
+        metricsRegistry.local().add(MetricCounter::RoutesOptimized);
+        logRoute(route);
+        return route;
+    }
+
+    // Plans every order in orderIds across the worker pool and returns the routes in the same order.
+    // Delivery legs are looked up in the route cache first; restaurant trees are only needed for
+    // the misses (and for every order once couriers exist). Missing trees are built in parallel
+    // against the frozen graph, then every remaining order is a lookup.
+    vector<DeliveryRoute> optimizeDeliveryRoutes(const vector<int>& orderIds) {
+        vector<DeliveryRoute> routes(orderIds.size());
+        uint32_t depotId = locations.find("Depot");
+        bool useCouriers = !couriers.empty();
+        if (!useCouriers && depotId == LocationTable::npos) {
+            for (size_t i = 0; i < routes.size(); ++i) {
+                routes[i].orderId = orderIds[i];
+                routes[i].status = Status::DepotMissing;
+            }
+            return routes;
+        }
+
+        const CsrGraph& g = graph();
+        const ShortestPathTree* depotTree = useCouriers ? nullptr : &shortestPathTree(depotId);
+
+        vector<uint32_t> handles(orderIds.size(), LocationTable::npos);
+        for (size_t i = 0; i < orderIds.size(); ++i) allOrders.find(orderIds[i], handles[i]);
+
+        ThreadPool& pool = workers();
+        uint64_t generation = routeCache.generation();
+        vector<char> cachedLegs(orderIds.size(), 0);
+        pool.parallelFor(orderIds.size(), [&](size_t i, unsigned) {
+            if (handles[i] == LocationTable::npos) return;
+            const Order& order = allOrders.at(handles[i]);
+            cachedLegs[i] = cachedDeliveryLeg(order.restaurant, order.destination, routes[i]);
+        });
+
+        size_t found = 0, treeLookups = 0;
+        vector<uint32_t> missingSources;
+        for (size_t i = 0; i < orderIds.size(); ++i) {
+            if (handles[i] == LocationTable::npos) continue;
+            ++found;
+            if (cachedLegs[i] && !useCouriers) continue;
+            ++treeLookups;
+            uint32_t restaurantId = allOrders.at(handles[i]).restaurant;
+            if (!pathTrees.count(restaurantId) &&
+                find(missingSources.begin(), missingSources.end(), restaurantId) == missingSources.end()) {
+                missingSources.push_back(restaurantId);
+            }
         }
-        Order orderToProcess = incomingOrders.front(); 
-        incomingOrders.pop();                          
-        cout << "Processing Order ID " << orderToProcess.id << "..." << endl;
-        
-        cout << "Order ID " << orderToProcess.id << " delivered successfully!" << endl;
-        completedOrders.push(orderToProcess); 
+
+        MetricsShard& metrics = metricsRegistry.local();
+        metrics.add(MetricCounter::TreeCacheMisses, missingSources.size());
+        metrics.add(MetricCounter::TreeCacheHits, treeLookups - missingSources.size());
+        metrics.add(MetricCounter::RoutesOptimized, found);
+
+        vector<ShortestPathTree> built(missingSources.size());
+        pool.parallelFor(missingSources.size(), [&](size_t i, unsigned) {
+            buildShortestPathTree(g, missingSources[i], built[i], frontierKind);
+        });
+        for (size_t i = 0; i < missingSources.size(); ++i) {
+            pathTrees.emplace(missingSources[i], move(built[i]));
+        }
+
+        pool.parallelFor(orderIds.size(), [&](size_t i, unsigned) {
+            DeliveryRoute& route = routes[i];
+            route.orderId = orderIds[i];
+            if (handles[i] == LocationTable::npos) return;
+            route.status = Status::Ok;
+            const Order& order = allOrders.at(handles[i]);
+            uint32_t restaurantId = order.restaurant;
+            uint32_t destinationId = order.destination;
+            if (!useCouriers) {
+                route.agentDistance = depotTree->distanceTo(restaurantId);
+                route.agentPath = depotTree->pathTo(restaurantId);
+                if (cachedLegs[i]) return;
+            }
+            const ShortestPathTree& restaurantTree = pathTrees.find(restaurantId)->second;
+            if (useCouriers) assignNearestCourier(g, restaurantId, restaurantTree, route);
+            if (cachedLegs[i]) return;
+            route.deliveryDistance = restaurantTree.distanceTo(destinationId);
+            route.deliveryPath = restaurantTree.pathTo(destinationId);
+            routeCache.insert(restaurantId, destinationId, generation, route.deliveryDistance, route.deliveryPath);
+        });
+        if (eventLog.enabled()) {
+            for (const DeliveryRoute& route : routes) logRoute(route);
+        }
+        return routes;
+    }
+
+    vector<int> pendingOrderIds() const {
+        vector<int> orderIds;
+        incomingOrders.forEach([&](uint32_t handle) { orderIds.push_back(OrderSlab::idFor(handle)); });
+        return orderIds;
     }
 
-  
-    void trackLastDelivery() {
-        if (completedOrders.empty()) {
-            cout << "No deliveries completed yet." << endl;
-            return;
+    // The slice of the queue a region's shard owns: orders picked up in the region, in queue order.
+    vector<int> pendingOrderIds(uint32_t region) {
+        const RegionOverlay& regions = overlay();
+        vector<int> orderIds;
+        incomingOrders.forEach([&](uint32_t handle) {
+            if (regions.regionOf(allOrders.at(handle).restaurant) == region) orderIds.push_back(OrderSlab::idFor(handle));
+        });
+        return orderIds;
+    }
+
+    vector<DeliveryRoute> optimizePendingRoutes() { return optimizeDeliveryRoutes(pendingOrderIds()); }
+
+    // Groups orders into multi-stop courier tours. Orders are taken oldest first; each seeds a tour
+    // and absorbs nearby orders from its window by cheapest insertion while that beats a separate
+    // trip. Distances come from one matrix over all stops. Unknown or unreachable orders are
+    // reported in unroutableOrderIds.
+    TourPlan planTours(const vector<int>& orderIds, const TourOptions& options = TourOptions()) {
+        TourPlan plan;
+        uint32_t depotId = locations.find("Depot");
+        if (depotId == LocationTable::npos) {
+            plan.status = Status::DepotMissing;
+            return plan;
+        }
+
+        vector<Order> orders;
+        vector<uint32_t> points = {depotId};
+        unordered_map<uint32_t, uint32_t> pointIndex = {{depotId, 0}};
+        vector<pair<uint32_t, uint32_t>> stops;  // matrix indices of pickup and drop-off
+        for (int orderId : orderIds) {
+            uint32_t handle;
+            if (!allOrders.find(orderId, handle)) {
+                plan.unroutableOrderIds.push_back(orderId);
+                continue;
+            }
+            orders.push_back(allOrders.at(handle));
+            uint32_t ends[2] = {orders.back().restaurant, orders.back().destination};
+            for (uint32_t& end : ends) {
+                auto inserted = pointIndex.emplace(end, static_cast<uint32_t>(points.size()));
+                if (inserted.second) points.push_back(end);
+                end = inserted.first->second;
+            }
+            stops.push_back({ends[0], ends[1]});
+        }
+        DistanceMatrix matrix = distanceMatrix(points, points);
+        recordSearch();
+
+        vector<long long> separate(orders.size());
+        vector<char> assigned(orders.size(), 0);
+        for (size_t k = 0; k < orders.size(); ++k) {
+            int toRestaurant = matrix.at(0, stops[k].first);
+            int toDestination = matrix.at(stops[k].first, stops[k].second);
+            if (toRestaurant == INT_MAX || toDestination == INT_MAX) {
+                assigned[k] = 1;
+                plan.unroutableOrderIds.push_back(orders[k].id);
+                continue;
+            }
+            separate[k] = static_cast<long long>(toRestaurant) + toDestination;
+        }
+
+        using Stop = TourSequencer::Stop;
+        TourSequencer sequencer(matrix, 0);
+        vector<Stop> tour;
+        vector<size_t> members;
+        for (size_t seed = 0; seed < orders.size(); ++seed) {
+            if (assigned[seed]) continue;
+            assigned[seed] = 1;
+            tour = {{0, stops[seed].first, true}, {0, stops[seed].second, false}};
+            members = {seed};
+
+            size_t windowEnd = min(orders.size(), seed + 1 + options.windowOrders);
+            while (members.size() < options.maxOrdersPerTour) {
+                long long bestDelta = LLONG_MAX;
+                size_t best = 0, pickupGap = 0, dropGap = 0;
+                uint32_t slot = static_cast<uint32_t>(members.size());
+                for (size_t k = seed + 1; k < windowEnd; ++k) {
+                    if (assigned[k] || matrix.at(stops[seed].first, stops[k].first) > options.pickupRadius) continue;
+                    size_t a, b;
+                    long long delta = sequencer.bestInsertion(tour, {slot, stops[k].first, true}, {slot, stops[k].second, false}, a, b);
+                    if (delta < separate[k] && delta < bestDelta) {
+                        bestDelta = delta;
+                        best = k;
+                        pickupGap = a;
+                        dropGap = b;
+                    }
+                }
+                if (bestDelta == LLONG_MAX) break;
+                TourSequencer::insert(tour, {slot, stops[best].first, true}, {slot, stops[best].second, false}, pickupGap, dropGap);
+                assigned[best] = 1;
+                members.push_back(best);
+            }
+            if (tour.size() > 2) sequencer.improve(tour);
+
+            CourierTour courier;
+            courier.distance = static_cast<int>(sequencer.cost(tour));
+            for (const Stop& stop : tour) {
+                courier.stops.push_back({orders[members[stop.slot]].id, points[stop.point], stop.pickup});
+            }
+            for (size_t k : members) courier.separateDistance += static_cast<int>(separate[k]);
+            plan.distance += courier.distance;
+            plan.separateDistance += courier.separateDistance;
+            plan.tours.push_back(move(courier));
         }
-        
-        Order lastOrder = completedOrders.top();
-        cout << "Last Completed Delivery (ID: " << lastOrder.id << "): " << lastOrder.restaurant << " to " << lastOrder.destination << endl;
+        metricsRegistry.local().add(MetricCounter::ToursPlanned, plan.tours.size());
+        return plan;
     }
 
-    
-    void listPendingOrders() {
-        if (incomingOrders.empty()) {
-            cout << "The order queue is empty." << endl;
-            return;
-        }
-        queue<Order> tempQueue = incomingOrders; 
-        cout << "--- Pending Orders Queue ---" << endl;
-        int count = 1;
-        while (!tempQueue.empty()) {
-            Order order = tempQueue.front();
-            tempQueue.pop();
-            cout << count++ << ". ID: " << order.id << " | From: " << order.restaurant << " | To: " << order.destination << " | Price: $" << order.price << endl;
-        }
-        cout << "--------------------------" << endl;
-    }
+    TourPlan planPendingTours(const TourOptions& options = TourOptions()) { return planTours(pendingOrderIds(), options); }
 
-   
-    void optimizeDeliveryRoute(int orderId) {
-        if (allOrders.find(orderId) == allOrders.end()) {
-            cout << "Order ID " << orderId << " not found." << endl;
-            return;
+    // Batch dispatch: takes up to options.maxOrders pending orders and every available courier and
+    // matches them with AssignmentSolver, serving as many orders as possible. Each restaurant is
+    // offered its options.candidates nearest couriers, or with 0 a distance matrix row over all of
+    // them. A delivery leg is the same whichever courier takes the order, so the solver minimises
+    // agent legs only, and long deliveries are not passed over when couriers are short. Orders
+    // whose destination cannot be reached from the restaurant are rejected before matching, so
+    // they never hold a courier. Matched orders join the completed list together, in one critical
+    // section, and their couriers become unavailable. The rest are queued again afterwards, behind
+    // anything placed meanwhile under Fifo, so another thread may see the completions before the
+    // requeues. Call it while no other thread is processing orders.
+    DispatchResult dispatchPendingOrders(const DispatchOptions& options = DispatchOptions()) {
+        DispatchResult result;
+        vector<uint32_t> handles;
+        uint32_t handle;
+        while (handles.size() < options.maxOrders && incomingOrders.pop(handle)) handles.push_back(handle);
+        vector<uint32_t> idle;             // courier id - 1
+        vector<uint32_t> idleColumn(couriers.size(), AssignmentSolver::npos);
+        for (const Courier& courier : couriers) {
+            if (!courier.available) continue;
+            idleColumn[courier.id - 1] = static_cast<uint32_t>(idle.size());
+            idle.push_back(static_cast<uint32_t>(courier.id - 1));
         }
+        result.idleCouriers = idle.size();
 
-        Order order = allOrders[orderId];
-        string restaurant = order.restaurant;
-        string destination = order.destination;
-        string depot = "Depot"; 
-
-        if (deliveryGraph.find(depot) == deliveryGraph.end()) {
-            cout << "Error: 'Depot' location is missing for optimization." << endl;
-            return;
+        vector<uint32_t> restaurants;
+        unordered_map<uint32_t, uint32_t> restaurantIndex;
+        vector<uint32_t> orderRow(handles.size());
+        for (size_t i = 0; i < handles.size(); ++i) {
+            uint32_t restaurant = allOrders.at(handles[i]).restaurant;
+            auto inserted = restaurantIndex.emplace(restaurant, static_cast<uint32_t>(restaurants.size()));
+            if (inserted.second) restaurants.push_back(restaurant);
+            orderRow[i] = inserted.first->second;
         }
 
-       
-        vector<string> path1 = findShortestPath(depot, restaurant);
-        int distance1 = calculatePathDistance(path1);
+        // Delivery legs first, one search per restaurant; only deliverable orders are offered couriers.
+        const CsrGraph& g = graph();
+        ThreadPool& pool = workers();
+        vector<vector<size_t>> ordersAt(restaurants.size());
+        for (size_t i = 0; i < handles.size(); ++i) ordersAt[orderRow[i]].push_back(i);
+        vector<int> deliveryDistances(handles.size(), INT_MAX);
+        vector<vector<uint32_t>> deliveryPaths(handles.size());
+        pool.parallelFor(restaurants.size(), [&](size_t r, unsigned) {
+            vector<uint32_t> ends;
+            for (size_t i : ordersAt[r]) ends.push_back(allOrders.at(handles[i]).destination);
+            vector<int> distances(ends.size());
+            SearchStats stats;
+            multiTargetSearch(g, restaurants[r], ends, distances, stats);
+            const SearchContext& tree = threadSearchWorkspace().sides[0];
+            for (size_t e = 0; e < ends.size(); ++e) {
+                size_t i = ordersAt[r][e];
+                deliveryDistances[i] = distances[e];
+                if (distances[e] != INT_MAX) deliveryPaths[i] = tree.tracePath(ends[e]);
+            }
+        });
 
-        
-        vector<string> path2 = findShortestPath(restaurant, destination);
-        int distance2 = calculatePathDistance(path2);
+        // Agent legs per restaurant, routes being two-way: restaurant -> courier equals courier -> restaurant.
+        vector<vector<CourierDistance>> offers(restaurants.size());
+        if (!handles.empty() && !idle.empty() && options.candidates > 0) {
+            pool.parallelFor(restaurants.size(), [&](size_t r, unsigned) {
+                nearestCouriers(g, restaurants[r], options.candidates, offers[r]);
+            });
+        } else if (!handles.empty() && !idle.empty()) {
+            vector<uint32_t> positions;
+            for (uint32_t index : idle) positions.push_back(couriers[index].location);
+            DistanceMatrix matrix = distanceMatrix(restaurants, positions);
+            recordSearch();
+            for (uint32_t r = 0; r < matrix.rows; ++r) {
+                for (uint32_t j = 0; j < matrix.cols; ++j) {
+                    if (matrix.at(r, j) != INT_MAX) offers[r].push_back({couriers[idle[j]].id, matrix.at(r, j)});
+                }
+            }
+        }
+        vector<int> costs(handles.size() * idle.size(), INT_MAX);
+        for (size_t i = 0; i < handles.size(); ++i) {
+            if (deliveryDistances[i] == INT_MAX) continue;
+            for (const CourierDistance& offer : offers[orderRow[i]]) {
+                if (offer.distance <= options.maxAgentDistance) costs[i * idle.size() + idleColumn[offer.courierId - 1]] = offer.distance;
+            }
+        }
+        vector<uint32_t> match = AssignmentSolver::solve(costs, static_cast<uint32_t>(handles.size()), static_cast<uint32_t>(idle.size()));
 
-        cout << "--- Route Optimization for Order " << orderId << " ---" << endl;
-        
-        cout << "1. Agent Path (Depot to Restaurant) - Total Distance: ";
-        if (distance1 != INT_MAX) cout << distance1 << " km" << endl;
-        else cout << "N/A (Route not found)" << endl;
+        // Agent legs of every matched order come from one search per restaurant.
+        vector<vector<size_t>> byRestaurant(restaurants.size());
+        vector<size_t> matched;
+        for (size_t i = 0; i < handles.size(); ++i) {
+            if (match[i] == AssignmentSolver::npos) continue;
+            byRestaurant[orderRow[i]].push_back(matched.size());
+            matched.push_back(i);
+        }
+        result.routes.resize(matched.size());
+        pool.parallelFor(restaurants.size(), [&](size_t r, unsigned) {
+            if (byRestaurant[r].empty()) return;
+            vector<uint32_t> ends;
+            for (size_t k : byRestaurant[r]) ends.push_back(couriers[idle[match[matched[k]]]].location);
+            vector<int> distances(ends.size());
+            SearchStats stats;
+            multiTargetSearch(g, restaurants[r], ends, distances, stats);
+            const SearchContext& tree = threadSearchWorkspace().sides[0];
+            for (size_t e = 0; e < byRestaurant[r].size(); ++e) {
+                size_t k = byRestaurant[r][e];
+                size_t i = matched[k];
+                DeliveryRoute& route = result.routes[k];
+                route.orderId = allOrders.at(handles[i]).id;
+                route.status = Status::Ok;
+                route.courierId = couriers[idle[match[i]]].id;
+                route.agentDistance = distances[e];
+                route.agentPath = tree.tracePath(ends[e]);
+                reverse(route.agentPath.begin(), route.agentPath.end());
+                route.deliveryDistance = deliveryDistances[i];
+                route.deliveryPath = move(deliveryPaths[i]);
+            }
+        });
 
-        if (distance1 != INT_MAX && !path1.empty()) {
-            for (const string& loc : path1) {
-                cout << loc << (loc == path1.back() ? "" : " -> ");
+        // Copied before the trim, which may retire these very orders.
+        vector<Order> delivered;
+        delivered.reserve(matched.size());
+        for (size_t i : matched) delivered.push_back(allOrders.at(handles[i]));
+        size_t completed;
+        {
+            lock_guard<mutex> guard(completedLock);
+            for (size_t k = 0; k < matched.size(); ++k) {
+                if (journal.enabled()) journal.append(JournalEvent::Processed, delivered[k]);
+                completedOrders.push_back(handles[matched[k]]);
             }
-            cout << endl;
+            trimCompletedWindow();
+            completed = completedOrders.size();
         }
+        MetricsShard& metrics = metricsRegistry.local();
+        for (size_t i = 0; i < handles.size(); ++i) {
+            if (match[i] != AssignmentSolver::npos) continue;
+            if (deliveryDistances[i] == INT_MAX || !incomingOrders.push(handles[i], dispatchKey(allOrders.at(handles[i])))) {
+                rejectOrder(handles[i]);
+                ++result.rejectedOrders;
+            } else {
+                ++result.requeuedOrders;
+            }
+        }
+        for (const DeliveryRoute& route : result.routes) {
+            couriers[route.courierId - 1].available = false;
+            if (route.totalDistance() >= 0) result.distance += route.totalDistance();
+            logRoute(route);
+        }
+        metrics.add(MetricCounter::OrdersDispatched, matched.size());
+        metrics.add(MetricCounter::OrdersProcessed, matched.size());
+        metrics.add(MetricCounter::RoutesOptimized, matched.size());
+        metrics.raise(MetricHighWater::CompletedDeliveries, completed);
+        for (const Order& order : delivered) logOrder("order_delivered", order);
+        return result;
+    }
 
-        cout << "2. Delivery Path (Restaurant to Destination) - Total Distance: ";
-        if (distance2 != INT_MAX) cout << distance2 << " km" << endl;
-        else cout << "N/A (Route not found)" << endl;
+    void setWorkerThreads(unsigned threadCount) {
+        pool.reset(new ThreadPool(threadCount));
+    }
 
-        if (distance2 != INT_MAX && !path2.empty()) {
-            for (const string& loc : path2) {
-                cout << loc << (loc == path2.back() ? "" : " -> ");
-            }
-            cout << endl;
+#if FD_COROUTINES
+    // Drains the pending queue through five coroutine stages on one shared executor: intake
+    // checks the order against the network, routing finds the delivery leg (routeWorkers at a
+    // time, through the route cache), assignment picks the nearest available courier or the
+    // Depot, in-delivery hands the order over, and completion moves it to the completed list.
+    // Each hand-off is a bounded queue, so a backed-up stage slows only the stages upstream of it.
+    // Orders with no route are rejected; without an available courier they are queued again.
+    // Orders placed meanwhile from other threads are taken as long as intake finds any; routes
+    // and couriers must not change while it runs.
+    PipelineResult runOrderPipeline(const PipelineOptions& options = PipelineOptions()) {
+        PipelineResult result;
+        uint32_t depotId = locations.find("Depot");
+        if (couriers.empty() && depotId == LocationTable::npos) {
+            result.status = Status::DepotMissing;
+            return result;
         }
+        unsigned threads = options.threads ? options.threads : max(1u, thread::hardware_concurrency());
+        PipelineRun run(threads, options.queueCapacity);
+        run.graph = &graph();
+        run.depotTree = couriers.empty() ? &shortestPathTree(depotId) : nullptr;
+        run.cacheGeneration = routeCache.generation();
+        unsigned routers = max(1u, options.routeWorkers);
+        run.routers = routers;
 
-        int totalDistance = (distance1 == INT_MAX || distance2 == INT_MAX) ? -1 : distance1 + distance2;
-        if (totalDistance != -1) {
-             cout << "Total Estimated Delivery Distance: " << totalDistance << " km" << endl;
-        } else {
-             cout << "Total Estimated Delivery Distance: Cannot be calculated (Missing route)." << endl;
+        vector<StageTask> stages = {intakeStage(run), assignStage(run), deliveryStage(run), completionStage(run)};
+        for (unsigned i = 0; i < routers; ++i) stages.push_back(routeStage(run));
+        for (const StageTask& stage : stages) run.executor.schedule(stage.handle);
+        {
+            unique_lock<mutex> guard(run.doneLock);
+            run.doneSignal.wait(guard, [&] { return run.done; });
         }
-    }
-    
-    
-    int calculatePathDistance(const vector<string>& path) {
-        if (path.size() < 2) return 0;
-        int totalDistance = 0;
-        for (size_t i = 0; i < path.size() - 1; ++i) {
-            string start = path[i];
-            string end = path[i+1];
-            
-            if (deliveryGraph.count(start) && deliveryGraph[start].count(end)) {
-                totalDistance += deliveryGraph[start][end];
+
+        result = move(run.result);
+        result.rejectedOrders = run.rejected;
+        for (uint32_t handle : run.requeue) {
+            if (incomingOrders.push(handle, dispatchKey(allOrders.at(handle)))) {
+                ++result.requeuedOrders;
             } else {
-                return INT_MAX; 
+                rejectOrder(handle);
+                ++result.rejectedOrders;
             }
         }
-        return totalDistance;
+        result.stalls = run.routing.stallCount() + run.assigning.stallCount() + run.delivering.stallCount() +
+                        run.completing.stallCount();
+        return result;
     }
+#endif
 
     
-    void revertLastDelivery() {
+    
+
+    
+    OrderResult revertLastDelivery() {
+        OrderResult result;
+        lock_guard<mutex> guard(completedLock);
         if (completedOrders.empty()) {
-            cout << "No completed deliveries to revert." << endl;
-            return;
+            result.status = Status::NoCompletedDeliveries;
+            return result;
         }
-        Order revertedOrder = completedOrders.top(); 
-        completedOrders.pop();                       
-        incomingOrders.push(revertedOrder);          
-        cout << "Reverted delivery ID " << revertedOrder.id << " and placed back in the pending queue." << endl;
+        uint32_t handle = completedOrders.back();
+        if (!incomingOrders.push(handle, dispatchKey(allOrders.at(handle)))) {
+            result.status = Status::QueueFull;
+            return result;
+        }
+        if (journal.enabled()) journal.append(JournalEvent::Reverted, allOrders.at(handle));
+        completedOrders.pop_back();
+        MetricsShard& metrics = metricsRegistry.local();
+        metrics.add(MetricCounter::OrdersReverted);
+        metrics.raise(MetricHighWater::PendingOrders, incomingOrders.size());
+        result.order = allOrders.at(handle);
+        logOrder("order_reverted", result.order);
+        return result;
     }
 
 
-    void systemStatus() {
-        cout << "\n--- System Status ---" << endl;
-        cout << "Pending Orders (Queue Size): " << incomingOrders.size() << endl;
-        cout << "Completed Deliveries (Stack Size): " << completedOrders.size() << endl;
-        cout << "Next Order ID to use: " << nextOrderId << endl;
-        cout << "Total Locations in Graph: " << deliveryGraph.size() << endl;
-        cout << "Locations available: ";
-        for (const auto& pair : deliveryGraph) {
-            cout << pair.first << ", ";
+    SystemSummary systemStatus() const {
+        SystemSummary summary;
+        summary.pendingOrders = incomingOrders.size();
+        {
+            lock_guard<mutex> guard(completedLock);
+            summary.completedDeliveries = completedOrders.size();
         }
-       
-        cout << "\b\b \n---------------------\n" << endl;
+        summary.nextOrderId = allOrders.nextId();
+        for (uint32_t id = 0; id < locations.size(); ++id) {
+            summary.locationNames.emplace_back(locations.name(id));
+        }
+        sort(summary.locationNames.begin(), summary.locationNames.end());
+        return summary;
+    }
+
+    string_view locationName(uint32_t id) const { return locations.name(id); }
+
+    // Counters summed over every thread that has touched this system, plus current depths.
+    MetricsSnapshot metrics() const {
+        MetricsSnapshot snapshot = metricsRegistry.snapshot();
+        snapshot.pendingOrders = incomingOrders.size();
+        snapshot.routeCacheBytes = routeCache.bytes();
+        lock_guard<mutex> guard(completedLock);
+        snapshot.completedDeliveries = completedOrders.size();
+        return snapshot;
     }
+
+    // Structured events go to sink as JSON lines; nullptr (the default) turns logging off.
+    void setEventLog(ostream* sink) { eventLog.open(sink); }
+    void flushEventLog() { eventLog.flush(); }
 };
 
 
@@ -301,6 +5643,7 @@ void showMenu() {
     cout << "7. Optimize Delivery Route (Graph Dijkstra)" << endl;
     cout << "8. Revert Last Delivery (Stack Pop & Queue Push)" << endl;
     cout << "9. View System Status" << endl;
+    cout << "10. Optimize All Pending Routes (Parallel Batch)" << endl;
     cout << "0. Exit" << endl;
     cout << "=========================================================" << endl;
     cout << "Enter your choice: ";
@@ -340,13 +5683,1017 @@ string getStringInput() {
 
 
 
-int main() {
+// Console output for the menu. The core only returns results; the wording lives here.
+void printLocationAdded(Status status, const string& name) {
+    if (status == Status::Ok) cout << "Location added: " << name << endl;
+    else cout << "Location " << name << " already exists." << endl;
+}
+
+
+void printDeliveryRoute(const FoodDeliverySystem& fds, const DeliveryRoute& route) {
+    int orderId = route.orderId;
+    if (route.status == Status::DepotMissing) {
+        cout << "Error: 'Depot' location is missing for optimization." << endl;
+        return;
+    }
+    if (route.status != Status::Ok) {
+        cout << "Order ID " << orderId << " not found." << endl;
+        return;
+    }
+    int distance1 = route.agentDistance;
+    int distance2 = route.deliveryDistance;
+    vector<string> path1 = fds.locationNames(route.agentPath);
+    vector<string> path2 = fds.locationNames(route.deliveryPath);
+
+    cout << "--- Route Optimization for Order " << orderId << " ---" << endl;
+    
+    if (route.courierId) cout << "1. Courier " << route.courierId << " Path (Courier to Restaurant) - Total Distance: ";
+    else cout << "1. Agent Path (Depot to Restaurant) - Total Distance: ";
+    if (distance1 != INT_MAX) cout << distance1 << " km" << endl;
+    else cout << "N/A (Route not found)" << endl;
+
+    if (distance1 != INT_MAX && !path1.empty()) {
+        for (const string& loc : path1) {
+            cout << loc << (loc == path1.back() ? "" : " -> ");
+        }
+        cout << endl;
+    }
+
+    cout << "2. Delivery Path (Restaurant to Destination) - Total Distance: ";
+    if (distance2 != INT_MAX) cout << distance2 << " km" << endl;
+    else cout << "N/A (Route not found)" << endl;
+
+    if (distance2 != INT_MAX && !path2.empty()) {
+        for (const string& loc : path2) {
+            cout << loc << (loc == path2.back() ? "" : " -> ");
+        }
+        cout << endl;
+    }
+
+    long long totalDistance = route.totalDistance();
+    if (totalDistance != -1) {
+         cout << "Total Estimated Delivery Distance: " << totalDistance << " km" << endl;
+    } else {
+         cout << "Total Estimated Delivery Distance: Cannot be calculated (Missing route)." << endl;
+    }
+}
+
+
+void printPendingOrders(const FoodDeliverySystem& fds) {
+    int count = 1;
+    fds.forEachPendingOrder([&](const Order& order) {
+        if (count == 1) cout << "--- Pending Orders Queue ---" << endl;
+        cout << count++ << ". ID: " << order.id << " | From: " << fds.locationName(order.restaurant) << " | To: " << fds.locationName(order.destination) << " | Price: $" << order.price << endl;
+    });
+    if (count == 1) {
+        cout << "The order queue is empty." << endl;
+        return;
+    }
+    cout << "--------------------------" << endl;
+}
+
+
+void printSystemStatus(const FoodDeliverySystem& fds) {
+    SystemSummary summary = fds.systemStatus();
+    cout << "\n--- System Status ---" << endl;
+    cout << "Pending Orders (Queue Size): " << summary.pendingOrders << endl;
+    cout << "Completed Deliveries (Stack Size): " << summary.completedDeliveries << endl;
+    cout << "Next Order ID to use: " << summary.nextOrderId << endl;
+    cout << "Total Locations in Graph: " << summary.locationNames.size() << endl;
+    cout << "Locations available: ";
+    for (const string& name : summary.locationNames) {
+        cout << name << ", ";
+    }
+   
+    cout << "\b\b \n---------------------\n" << endl;
+}
+
+
+bool parseNodeOrder(const string& name, NodeOrder& order) {
+    if (name == "auto") order = NodeOrder::Auto;
+    else if (name == "hilbert") order = NodeOrder::Hilbert;
+    else if (name == "rcm") order = NodeOrder::CuthillMcKee;
+    else return false;
+    return true;
+}
+
+
+// Reports a --load/--save/--import-csv outcome; returns false on failure.
+bool printNetworkFileResult(const NetworkFileResult& result, const char* action, const string& path) {
+    switch (result.status) {
+        case Status::Ok: break;
+        case Status::NetworkNotEmpty:
+            cout << "Error: A network snapshot can only be loaded into an empty system." << endl;
+            return false;
+        case Status::FileError:
+            cout << "Error: " << result.detail << "." << endl;
+            return false;
+        default:
+            cout << "Error: " << path << " is not a valid version " << NetworkFileHeader::currentVersion
+                 << " network snapshot." << endl;
+            return false;
+    }
+    if (string(action) == "import") {
+        cout << "Imported " << result.routesImported << " routes from " << path;
+        if (result.malformedLines) {
+            cout << " (skipped " << result.malformedLines << " malformed lines, first at line " << result.firstMalformedLine << ")";
+        }
+        cout << endl;
+    } else {
+        cout << "Network " << action << ": " << result.locations << " locations, " << result.directedEdges << " directed edges "
+             << (string(action) == "saved" ? "to " : "from ") << path << endl;
+    }
+    return true;
+}
+
+
+bool printJournalResult(const JournalResult& result, const string& path) {
+    switch (result.status) {
+        case Status::Ok: break;
+        case Status::OrdersNotEmpty:
+            cout << "Error: The order journal has to be opened before any order is placed." << endl;
+            return false;
+        default:
+            cout << "Error: " << result.detail << "." << endl;
+            return false;
+    }
+    cout << "Journal " << path << ": replayed " << result.records << " records, " << result.pendingOrders
+         << " pending orders, " << result.completedDeliveries << " completed deliveries";
+    if (result.discardedBytes) cout << " (dropped " << result.discardedBytes << " bytes of torn tail)";
+    cout << endl;
+    return true;
+}
+
+
+// Splits a batch command into whitespace-separated fields; "double quotes" keep names with spaces together.
+vector<string> splitCommand(const string& line) {
+    vector<string> fields;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) ++i;
+        if (i == line.size()) break;
+        string field;
+        if (line[i] == '"') {
+            size_t close = line.find('"', i + 1);
+            if (close == string::npos) close = line.size();
+            field = line.substr(i + 1, close - i - 1);
+            i = close + 1;
+        } else {
+            while (i < line.size() && !isspace(static_cast<unsigned char>(line[i]))) field += line[i++];
+        }
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+
+// Headless driver: one command per line, one JSON result line per command.
+//   network    location <name> [lat lon]          route <a> <b> <km>
+//              profile <a> <b> <factor>...        reorder [auto|hilbert|rcm]
+//   orders     order <restaurant> <destination> <price> [slaMinutes]
+//              scheduler fifo|priority            process            revert
+//              optimize <orderId> | pending | region <region>
+//              dispatch [maxOrders]               pipeline           tours [maxOrdersPerTour]
+//   couriers   courier <location>                 move <courierId> <location> | <lat> <lon>
+//              available <courierId> yes|no       nearest <location> [count]
+//   search     mode dijkstra|bidirectional|astar|ch|overlay
+//              partition <regionSize>             region <location>
+//              distance <a> <b>                   path <a> <b>       eta <a> <b> <seconds|hh:mm>
+//   metrics
+// A command added to the loop below belongs in this list too.
+// Failures carry a snake_case status: a statusName() or an argument error; pipeline answers
+// unsupported in builds without coroutines. Results are buffered and only flushed once the
+// input has nothing more buffered (or the buffer grows large), so a gateway streaming commands
+// gets one write per burst instead of one flush per line. Returns the number of failed commands.
+size_t runBatch(FoodDeliverySystem& fds, istream& in, ostream& out) {
+    const size_t flushBytes = 1 << 16;
+    string buffer;
+    size_t lineNumber = 0, failures = 0;
+    string line;
+
+    while (getline(in, line)) {
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        vector<string> fields = splitCommand(line);
+        if (fields.empty() || fields[0][0] == '#') continue;
+
+        const string& op = fields[0];
+        buffer += "{\"line\":" + to_string(lineNumber) + ",\"op\":";
+        writeJsonString(buffer, op);
+        const char* failure = nullptr;
+        auto number = [&](const string& text, double& value) {
+            char* end = nullptr;
+            value = strtod(text.c_str(), &end);
+            return end != text.c_str() && *end == '\0';
+        };
+        auto writeOrder = [&](const OrderResult& result) {
+            if (result.status != Status::Ok) failure = statusName(result.status);
+            else buffer += ",\"ok\":true,\"orderId\":" + to_string(result.order.id);
+        };
+        auto writeRoutes = [&](const vector<DeliveryRoute>& routes) {
+            buffer += ",\"routes\":[";
+            for (size_t i = 0; i < routes.size(); ++i) {
+                const DeliveryRoute& route = routes[i];
+                if (i) buffer += ',';
+                buffer += "{\"orderId\":" + to_string(route.orderId) + ",\"status\":\"" + statusName(route.status) + "\"";
+                if (route.courierId) buffer += ",\"courierId\":" + to_string(route.courierId);
+                if (route.status == Status::Ok) {
+                    buffer += ",\"agentDistance\":";
+                    writeJsonDistance(buffer, route.agentDistance);
+                    buffer += ",\"deliveryDistance\":";
+                    writeJsonDistance(buffer, route.deliveryDistance);
+                    buffer += ",\"totalDistance\":";
+                    writeJsonDistance(buffer, route.totalDistance());
+                    buffer += ",\"agentPath\":";
+                    writeJsonPath(buffer, fds.locationNames(route.agentPath));
+                    buffer += ",\"deliveryPath\":";
+                    writeJsonPath(buffer, fds.locationNames(route.deliveryPath));
+                }
+                buffer += '}';
+            }
+            buffer += ']';
+        };
+        double a = 0, b = 0, c = 0;
+
+        if (op == "location" && (fields.size() == 2 || fields.size() == 4)) {
+            if (fields.size() == 4 && !(number(fields[2], a) && number(fields[3], b))) {
+                failure = "invalid_coordinates";
+            } else {
+                Status status = fields.size() == 2 ? fds.addLocation(fields[1]) : fds.addLocation(fields[1], a, b);
+                buffer += status == Status::Ok ? ",\"ok\":true" : ",\"ok\":true,\"existed\":true";
+            }
+        } else if (op == "route" && fields.size() == 4) {
+            Status status = Status::InvalidDistance;
+            if (number(fields[3], a) && a == floor(a) && a <= INT_MAX) {
+                status = fds.addRoute(fields[1], fields[2], static_cast<int>(a));
+            }
+            if (status != Status::Ok) failure = statusName(status);
+            else buffer += ",\"ok\":true";
+        } else if (op == "order" && (fields.size() == 4 || fields.size() == 5)) {
+            if (!number(fields[3], a)) failure = "invalid_price";
+            else if (fields.size() == 5 && !(number(fields[4], b) && b > 0)) failure = "invalid_sla";
+            else writeOrder(fds.placeOrder(fields[1], fields[2], a, fields.size() == 5 ? static_cast<uint32_t>(b * 60) : 0));
+        } else if (op == "scheduler" && fields.size() == 2 && (fields[1] == "fifo" || fields[1] == "priority")) {
+            SchedulerOptions options = fds.scheduler();
+            options.policy = fields[1] == "fifo" ? SchedulingPolicy::Fifo : SchedulingPolicy::Priority;
+            fds.setScheduler(options);
+            buffer += ",\"ok\":true";
+        } else if ((op == "process" || op == "revert") && fields.size() == 1) {
+            writeOrder(op == "process" ? fds.processNextOrder() : fds.revertLastDelivery());
+        } else if (op == "optimize" && (fields.size() == 2 || (fields.size() == 3 && fields[1] == "region"))) {
+            vector<int> orderIds;
+            if (fields.size() == 3) {
+                if (number(fields[2], a) && a >= 0 && a < fds.regionCount()) orderIds = fds.pendingOrderIds(static_cast<uint32_t>(a));
+                else failure = "invalid_region";
+            } else if (fields[1] == "pending") {
+                orderIds = fds.pendingOrderIds();
+            } else if (number(fields[1], a)) {
+                orderIds.push_back(static_cast<int>(a));
+            } else {
+                failure = "invalid_order_id";
+            }
+            vector<DeliveryRoute> routes;
+            if (!failure) routes = fds.optimizeDeliveryRoutes(orderIds);
+            if (!routes.empty() && routes[0].status == Status::DepotMissing) failure = statusName(Status::DepotMissing);
+            if (!failure) {
+                buffer += ",\"ok\":true";
+                writeRoutes(routes);
+            }
+        } else if (op == "mode" && fields.size() == 2) {
+            const pair<const char*, SearchMode> modes[] = {
+                {"dijkstra", SearchMode::Dijkstra},
+                {"bidirectional", SearchMode::Bidirectional},
+                {"astar", SearchMode::AStar},
+                {"ch", SearchMode::ContractionHierarchy},
+                {"overlay", SearchMode::Overlay},
+            };
+            failure = "invalid_mode";
+            for (const auto& mode : modes) {
+                if (fields[1] != mode.first) continue;
+                fds.setSearchMode(mode.second);
+                failure = nullptr;
+                buffer += ",\"ok\":true";
+            }
+        } else if (op == "partition" && fields.size() == 2) {
+            if (!number(fields[1], a) || a < 1 || a > UINT32_MAX) {
+                failure = "invalid_region_size";
+            } else {
+                fds.setRegionSize(static_cast<uint32_t>(a));
+                buffer += ",\"ok\":true,\"regions\":" + to_string(fds.regionCount());
+            }
+        } else if (op == "region" && fields.size() == 2) {
+            uint32_t region = fds.regionOf(fields[1]);
+            if (region == LocationTable::npos) failure = statusName(Status::UnknownLocation);
+            else buffer += ",\"ok\":true,\"region\":" + to_string(region);
+        } else if (op == "dispatch" && fields.size() <= 2) {
+            DispatchOptions options;
+            if (fields.size() == 2) {
+                if (number(fields[1], a) && a >= 1) options.maxOrders = static_cast<size_t>(a);
+                else failure = "invalid_order_count";
+            }
+            if (!failure) {
+                DispatchResult result = fds.dispatchPendingOrders(options);
+                buffer += ",\"ok\":true,\"distance\":" + to_string(result.distance) +
+                          ",\"rejected\":" + to_string(result.rejectedOrders) + ",\"requeued\":" + to_string(result.requeuedOrders) +
+                          ",\"idleCouriers\":" + to_string(result.idleCouriers);
+                writeRoutes(result.routes);
+            }
+        } else if (op == "pipeline" && fields.size() == 1) {
+#if FD_COROUTINES
+            PipelineResult result = fds.runOrderPipeline();
+            if (result.status != Status::Ok) failure = statusName(result.status);
+            else {
+                buffer += ",\"ok\":true,\"rejected\":" + to_string(result.rejectedOrders) + ",\"requeued\":" +
+                          to_string(result.requeuedOrders) + ",\"stalls\":" + to_string(result.stalls);
+                writeRoutes(result.routes);
+            }
+#else
+            failure = "unsupported";
+#endif
+        } else if (op == "courier" && fields.size() == 2) {
+            CourierResult result = fds.addCourier(fields[1]);
+            if (result.status != Status::Ok) failure = statusName(result.status);
+            else buffer += ",\"ok\":true,\"courierId\":" + to_string(result.courier.id);
+        } else if (op == "move" && (fields.size() == 3 || fields.size() == 4)) {
+            CourierResult result;
+            if (!number(fields[1], a)) failure = "invalid_courier_id";
+            else if (fields.size() == 3) result = fds.moveCourier(static_cast<int>(a), fields[2]);
+            else if (number(fields[2], b) && number(fields[3], c)) result = fds.moveCourier(static_cast<int>(a), b, c);
+            else failure = "invalid_coordinates";
+            if (!failure && result.status != Status::Ok) failure = statusName(result.status);
+            if (!failure) {
+                buffer += ",\"ok\":true,\"location\":";
+                writeJsonString(buffer, fds.locationName(result.courier.location));
+            }
+        } else if (op == "available" && fields.size() == 3 && (fields[2] == "yes" || fields[2] == "no")) {
+            Status status = number(fields[1], a) ? fds.setCourierAvailable(static_cast<int>(a), fields[2] == "yes") : Status::CourierNotFound;
+            if (status != Status::Ok) failure = statusName(status);
+            else buffer += ",\"ok\":true";
+        } else if (op == "nearest" && (fields.size() == 2 || fields.size() == 3)) {
+            if (fields.size() == 3 && !(number(fields[2], a) && a >= 1)) failure = "invalid_count";
+            else {
+                vector<CourierDistance> nearest = fds.nearestCouriers(fields[1], fields.size() == 3 ? static_cast<size_t>(a) : 1);
+                buffer += ",\"ok\":true,\"couriers\":[";
+                for (size_t i = 0; i < nearest.size(); ++i) {
+                    if (i) buffer += ',';
+                    buffer += "{\"courierId\":" + to_string(nearest[i].courierId) + ",\"distance\":" + to_string(nearest[i].distance) + "}";
+                }
+                buffer += ']';
+            }
+        } else if (op == "tours" && fields.size() <= 2) {
+            TourOptions options;
+            if (fields.size() == 2) {
+                if (number(fields[1], a) && a > 0) options.maxOrdersPerTour = static_cast<size_t>(a);
+                else failure = "invalid_tour_size";
+            }
+            TourPlan plan;
+            if (!failure) plan = fds.planPendingTours(options);
+            if (!failure && plan.status != Status::Ok) failure = statusName(plan.status);
+            if (!failure) {
+                buffer += ",\"ok\":true,\"distance\":" + to_string(plan.distance) +
+                          ",\"separateDistance\":" + to_string(plan.separateDistance) + ",\"tours\":[";
+                for (size_t i = 0; i < plan.tours.size(); ++i) {
+                    const CourierTour& tour = plan.tours[i];
+                    if (i) buffer += ',';
+                    buffer += "{\"distance\":" + to_string(tour.distance) + ",\"stops\":[";
+                    for (size_t j = 0; j < tour.stops.size(); ++j) {
+                        const TourStop& stop = tour.stops[j];
+                        if (j) buffer += ',';
+                        buffer += "{\"orderId\":" + to_string(stop.orderId) + ",\"action\":\"" +
+                                  (stop.pickup ? "pickup" : "dropoff") + "\",\"location\":";
+                        writeJsonString(buffer, fds.locationName(stop.location));
+                        buffer += '}';
+                    }
+                    buffer += "]}";
+                }
+                buffer += "],\"unroutable\":[";
+                for (size_t i = 0; i < plan.unroutableOrderIds.size(); ++i) {
+                    if (i) buffer += ',';
+                    buffer += to_string(plan.unroutableOrderIds[i]);
+                }
+                buffer += ']';
+            }
+        } else if ((op == "distance" || op == "path") && fields.size() == 3) {
+            if (op == "distance") {
+                buffer += ",\"ok\":true,\"distance\":";
+                writeJsonDistance(buffer, fds.shortestDistance(fields[1], fields[2]));
+            } else {
+                PathResult path = fds.shortestPath(fields[1], fields[2], true);
+                buffer += ",\"ok\":true,\"distance\":";
+                writeJsonDistance(buffer, path.distance);
+                buffer += ",\"path\":";
+                writeJsonPath(buffer, fds.locationNames(path.nodes));
+                buffer += ",\"legs\":[";
+                for (size_t i = 0; i < path.legs.size(); ++i) {
+                    if (i) buffer += ',';
+                    buffer += to_string(path.legs[i]);
+                }
+                buffer += ']';
+            }
+        } else if (op == "profile" && fields.size() >= 3) {
+            vector<double> factors;
+            for (size_t i = 3; i < fields.size() && !failure; ++i) {
+                if (number(fields[i], a)) factors.push_back(a);
+                else failure = "invalid_profile";
+            }
+            Status status = failure ? Status::Ok : fds.setRouteProfile(fields[1], fields[2], factors);
+            if (status != Status::Ok) failure = statusName(status);
+            else if (!failure) buffer += ",\"ok\":true";
+        } else if (op == "reorder" && fields.size() <= 2) {
+            NodeOrder order = NodeOrder::Auto;
+            if (fields.size() == 2 && !parseNodeOrder(fields[1], order)) {
+                failure = "invalid_order";
+            } else {
+                Status status = fds.reorderLocations(order);
+                if (status != Status::Ok) failure = statusName(status);
+                else buffer += ",\"ok\":true";
+            }
+        } else if (op == "eta" && fields.size() == 4) {
+            // Departure as seconds after midnight or hh:mm.
+            unsigned hours, minutes;
+            char tail;
+            if (sscanf(fields[3].c_str(), "%u:%u%c", &hours, &minutes, &tail) == 2 && minutes < 60) a = hours * 3600.0 + minutes * 60.0;
+            else if (!number(fields[3], a) || a < 0 || a > UINT32_MAX) failure = "invalid_departure";
+            if (!failure) {
+                PathResult path = fds.fastestPath(fields[1], fields[2], static_cast<uint32_t>(a));
+                buffer += ",\"ok\":true,\"seconds\":";
+                writeJsonDistance(buffer, path.distance);
+                buffer += ",\"path\":";
+                writeJsonPath(buffer, fds.locationNames(path.nodes));
+                buffer += ",\"legs\":[";
+                for (size_t i = 0; i < path.legs.size(); ++i) {
+                    if (i) buffer += ',';
+                    buffer += to_string(path.legs[i]);
+                }
+                buffer += ']';
+            }
+        } else if (op == "metrics" && fields.size() == 1) {
+            MetricsSnapshot metrics = fds.metrics();
+            const pair<const char*, MetricCounter> counters[] = {
+                {"searches", MetricCounter::Searches},
+                {"nodesSettled", MetricCounter::NodesSettled},
+                {"edgesRelaxed", MetricCounter::EdgesRelaxed},
+                {"ordersPlaced", MetricCounter::OrdersPlaced},
+                {"ordersRejected", MetricCounter::OrdersRejected},
+                {"ordersProcessed", MetricCounter::OrdersProcessed},
+                {"ordersReverted", MetricCounter::OrdersReverted},
+                {"routesOptimized", MetricCounter::RoutesOptimized},
+            };
+            buffer += ",\"ok\":true";
+            for (const auto& counter : counters) {
+                buffer += string(",\"") + counter.first + "\":" + to_string(metrics.count(counter.second));
+            }
+            buffer += ",\"pendingHighWater\":" + to_string(metrics.peak(MetricHighWater::PendingOrders)) +
+                      ",\"treeCacheHitRate\":" + to_string(metrics.treeCacheHitRate()) +
+                      ",\"routeCacheHitRate\":" + to_string(metrics.routeCacheHitRate()) +
+                      ",\"findShortestPathP99Seconds\":" +
+                      to_string(metrics.timer(MetricTimer::FindShortestPath).quantileSeconds(0.99)) +
+                      ",\"optimizeDeliveryRouteP99Seconds\":" +
+                      to_string(metrics.timer(MetricTimer::OptimizeDeliveryRoute).quantileSeconds(0.99));
+        } else {
+            failure = "unknown_command";
+        }
+
+        if (failure) {
+            ++failures;
+            buffer += ",\"ok\":false,\"status\":\"";
+            buffer += failure;
+            buffer += '"';
+        }
+        buffer += "}\n";
+
+        if (buffer.size() >= flushBytes || in.rdbuf()->in_avail() <= 0) {
+            out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+            out.flush();
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+    out.flush();
+    return failures;
+}
+
+
+// Counts heap allocations so the benchmarks can report allocations per operation. Replacing
+// operator new puts an atomic add on every allocation of every thread, so it is only built
+// with FD_ALLOCATION_COUNTER defined; otherwise --bench leaves the allocs/op column empty.
+#ifdef FD_ALLOCATION_COUNTER
+constexpr bool countingAllocations = true;
+atomic<uint64_t> allocationCount{0};
+
+// Kept out of line so GCC does not see malloc/free through the replaced operators and flag
+// every new/delete pair as mismatched.
+#if defined(__GNUC__)
+#define FD_NOINLINE __attribute__((noinline))
+#else
+#define FD_NOINLINE
+#endif
+
+FD_NOINLINE void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void* memory = malloc(size ? size : 1)) return memory;
+    throw bad_alloc();
+}
+
+FD_NOINLINE void operator delete(void* memory) noexcept { free(memory); }
+FD_NOINLINE void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+uint64_t allocationsSoFar() { return allocationCount.load(memory_order_relaxed); }
+#else
+constexpr bool countingAllocations = false;
+uint64_t allocationsSoFar() { return 0; }
+#endif
+
+
+// Square grid of locations roughly 0.9 km apart with two-way routes of 1-3 km.
+void buildGridCity(FoodDeliverySystem& fds, int side, unsigned seed) {
+    mt19937 rng(seed);
+    for (int r = 0; r < side; ++r) {
+        for (int c = 0; c < side; ++c) {
+            fds.addLocation("G" + to_string(r * side + c), 40.0 + r * 0.008, -74.0 + c * 0.008);
+        }
+    }
+    for (int r = 0; r < side; ++r) {
+        for (int c = 0; c < side; ++c) {
+            string here = "G" + to_string(r * side + c);
+            if (c + 1 < side) fds.addRoute(here, "G" + to_string(r * side + c + 1), 1 + static_cast<int>(rng() % 3));
+            if (r + 1 < side) fds.addRoute(here, "G" + to_string((r + 1) * side + c), 1 + static_cast<int>(rng() % 3));
+        }
+    }
+}
+
+
+// Random graph: every location gets `degree` two-way routes to random others, weighted 1..maxWeight.
+void buildRandomCity(FoodDeliverySystem& fds, int nodes, int degree, int maxWeight, unsigned seed) {
+    mt19937 rng(seed);
+    for (int i = 0; i < nodes; ++i) fds.addLocation("R" + to_string(i));
+    for (int i = 0; i < nodes; ++i) {
+        for (int d = 0; d < degree; ++d) {
+            fds.addRoute("R" + to_string(i), "R" + to_string(rng() % nodes), 1 + static_cast<int>(rng() % maxWeight));
+        }
+    }
+}
+
+
+// Full one-to-all searches from a few sources, once per frontier kind, on graphs whose
+// shape favours different heaps: sparse small-weight grids, dense graphs with many
+// decrease-keys, and wide weight ranges.
+void benchmarkFrontiers(int sources) {
+    struct Shape {
+        const char* name;
+        const char* prefix;
+        int nodes;
+        function<void(FoodDeliverySystem&)> build;
+    };
+    const Shape shapes[] = {
+        {"grid 200x200, weights 1-3", "G", 40000, [](FoodDeliverySystem& fds) { buildGridCity(fds, 200, 42); }},
+        {"dense random 4k nodes, degree 32", "R", 4000, [](FoodDeliverySystem& fds) { buildRandomCity(fds, 4000, 32, 100, 42); }},
+        {"sparse random 40k nodes, weights 1-1M", "R", 40000, [](FoodDeliverySystem& fds) { buildRandomCity(fds, 40000, 3, 1000000, 42); }},
+    };
+    const pair<FrontierKind, const char*> kinds[] = {
+        {FrontierKind::BinaryHeap, "binary heap"},
+        {FrontierKind::QuaternaryHeap, "indexed 4-ary heap"},
+        {FrontierKind::RadixHeap, "radix heap"},
+    };
+
+    cout << "--- Frontier Benchmark (" << sources << " one-to-all searches per shape) ---\n";
+    for (const Shape& shape : shapes) {
+        FoodDeliverySystem fds;
+        shape.build(fds);
+        vector<string> targets;
+        for (int i = 0; i < shape.nodes; ++i) targets.push_back(shape.prefix + to_string(i));
+        mt19937 rng(7);
+        vector<string> origins;
+        for (int i = 0; i < sources; ++i) origins.push_back(targets[rng() % targets.size()]);
+
+        cout << shape.name << ":\n";
+        vector<int> reference;
+        for (const auto& kind : kinds) {
+            fds.setFrontier(kind.first);
+            auto start = chrono::steady_clock::now();
+            DistanceMatrix matrix = fds.distanceMatrix(origins, targets);
+            double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << "  " << kind.second << ": " << totalMs / sources << " ms/search";
+            if (reference.empty()) reference = matrix.values;
+            else if (reference != matrix.values) cout << " (distance mismatch)";
+            cout << "\n";
+        }
+    }
+    cout.flush();
+}
+
+
+void benchmarkContractionHierarchy(int side, int queries) {
+    FoodDeliverySystem fds;
+    buildGridCity(fds, side, 42);
+
+    mt19937 rng(7);
+    vector<pair<string, string>> pairs;
+    for (int i = 0; i < queries; ++i) {
+        pairs.push_back({"G" + to_string(rng() % (side * side)), "G" + to_string(rng() % (side * side))});
+    }
+
+    cout << "--- Contraction Hierarchy Benchmark (" << side << "x" << side << " grid, " << queries << " queries) ---\n";
+
+    fds.setSearchMode(SearchMode::ContractionHierarchy);
+    auto buildStart = chrono::steady_clock::now();
+    fds.findShortestPath(pairs[0].first, pairs[0].second);
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count();
+    cout << "Preprocessing: " << buildMs << " ms\n";
+    buildStart = chrono::steady_clock::now();
+    uint32_t regions = fds.regionCount();
+    buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count();
+    cout << "Overlay preprocessing: " << buildMs << " ms (" << regions << " regions)\n";
+
+    const pair<SearchMode, const char*> modes[] = {
+        {SearchMode::Dijkstra, "Dijkstra"},
+        {SearchMode::Bidirectional, "Bidirectional"},
+        {SearchMode::AStar, "A*"},
+        {SearchMode::ContractionHierarchy, "Contraction Hierarchy"},
+        {SearchMode::Overlay, "Region overlay"},
+    };
+    vector<int> reference;
+    for (const auto& mode : modes) {
+        fds.setSearchMode(mode.first);
+        uint64_t settled = 0;
+        int mismatches = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            int distance = fds.shortestPath(pairs[i].first, pairs[i].second).distance;
+            settled += fds.lastSearch().nodesSettled;
+            if (reference.size() < pairs.size()) reference.push_back(distance);
+            else if (reference[i] != distance) ++mismatches;
+        }
+        double totalUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        cout << mode.second << ": " << totalUs / queries << " us/query, "
+             << settled / static_cast<uint64_t>(queries) << " nodes settled/query";
+        if (mismatches) cout << ", " << mismatches << " distance mismatches";
+        cout << "\n";
+    }
+
+    vector<string> tableSources, tableTargets;
+    for (int i = 0; i < 300; ++i) {
+        tableSources.push_back("G" + to_string(rng() % (side * side)));
+        tableTargets.push_back("G" + to_string(rng() % (side * side)));
+    }
+    fds.setSearchMode(SearchMode::ContractionHierarchy);
+    auto tableStart = chrono::steady_clock::now();
+    fds.distanceMatrix(tableSources, tableTargets);
+    double tableMs = chrono::duration<double, milli>(chrono::steady_clock::now() - tableStart).count();
+    cout << "Distance table 300x300: " << tableMs << " ms (" << distanceKernels().name << " kernels)\n";
+    cout.flush();
+}
+
+
+
+// Random geometric city: nodes scattered over a square with the grid's density, each joined
+// to every neighbour within a radius that gives about six routes per node. Weights are the
+// straight-line distance rounded up, so the A* estimate stays admissible.
+void buildGeometricCity(FoodDeliverySystem& fds, int nodes, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    double sideDegrees = sqrt(static_cast<double>(nodes)) * 0.008;
+    double radius = sqrt(6.0 / (M_PI * nodes)) * sideDegrees;
+    vector<pair<double, double>> points(nodes);
+    int cellsPerSide = max(1, static_cast<int>(sideDegrees / radius));
+    vector<vector<int>> cells(static_cast<size_t>(cellsPerSide) * cellsPerSide);
+    auto cellOf = [&](double offset) { return min(cellsPerSide - 1, static_cast<int>(offset / sideDegrees * cellsPerSide)); };
+    for (int i = 0; i < nodes; ++i) {
+        double latOffset = unit(rng) * sideDegrees, lonOffset = unit(rng) * sideDegrees;
+        points[i] = {40.0 + latOffset, -74.0 + lonOffset};
+        fds.addLocation("P" + to_string(i), points[i].first, points[i].second);
+        cells[static_cast<size_t>(cellOf(latOffset)) * cellsPerSide + cellOf(lonOffset)].push_back(i);
+    }
+    double radiusKm = radius * 111.0;
+    for (int i = 0; i < nodes; ++i) {
+        int row = cellOf(points[i].first - 40.0), col = cellOf(points[i].second + 74.0);
+        for (int r = max(0, row - 1); r <= min(cellsPerSide - 1, row + 1); ++r) {
+            for (int c = max(0, col - 1); c <= min(cellsPerSide - 1, col + 1); ++c) {
+                for (int j : cells[static_cast<size_t>(r) * cellsPerSide + c]) {
+                    if (j <= i) continue;
+                    double km = haversineKm(points[i].first, points[i].second, points[j].first, points[j].second);
+                    if (km <= radiusKm) fds.addRoute("P" + to_string(i), "P" + to_string(j), max(1, static_cast<int>(ceil(km))));
+                }
+            }
+        }
+    }
+}
+
+
+struct BenchmarkResult {
+    size_t iterations = 0;
+    double opsPerSecond = 0;
+    double p50Micros = 0;
+    double p99Micros = 0;
+    double allocationsPerOp = 0;
+};
+
+
+// Runs op(i) until the time budget is spent (at least minIterations, at most maxIterations),
+// timing every call. Latency storage is reserved up front so it never shows up as an allocation.
+template <typename Op>
+BenchmarkResult runBenchmark(double budgetSeconds, size_t minIterations, size_t maxIterations, Op op) {
+    vector<double> latencies;
+    latencies.reserve(maxIterations);
+    uint64_t allocationsBefore = allocationsSoFar();
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::duration<double>(budgetSeconds);
+    while (latencies.size() < maxIterations &&
+           (latencies.size() < minIterations || chrono::steady_clock::now() < deadline)) {
+        auto before = chrono::steady_clock::now();
+        op(latencies.size());
+        latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - before).count());
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    BenchmarkResult result;
+    result.iterations = latencies.size();
+    if (latencies.empty()) return result;
+    result.allocationsPerOp = static_cast<double>(allocationsSoFar() - allocationsBefore) / latencies.size();
+    result.opsPerSecond = latencies.size() / elapsed;
+    sort(latencies.begin(), latencies.end());
+    result.p50Micros = latencies[latencies.size() / 2];
+    result.p99Micros = latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    return result;
+}
+
+
+void printBenchmarkResult(const string& name, const BenchmarkResult& result) {
+    printf("%-44s %10zu %12.0f %12.2f %12.2f ", name.c_str(), result.iterations, result.opsPerSecond, result.p50Micros,
+           result.p99Micros);
+    if (countingAllocations) printf("%10.2f\n", result.allocationsPerOp);
+    else printf("%10s\n", "-");
+}
+
+
+// Regression suite over grid and random geometric cities of the requested sizes: shortest
+// paths, order route optimisation (cold trees for a fixed set of restaurants, then warm),
+// the place -> process order flow and reverting deliveries.
+void benchmarkSuite(const vector<int>& sizes, double budgetSeconds) {
+    printf("%-44s %10s %12s %12s %12s %10s\n", "Benchmark", "Iterations", "ops/s", "p50 (us)", "p99 (us)", "allocs/op");
+    for (int size : sizes) {
+        for (int shape = 0; shape < 2; ++shape) {
+            FoodDeliverySystem fds;
+            string prefix;
+            int nodes;
+            auto buildStart = chrono::steady_clock::now();
+            if (shape == 0) {
+                int side = max(2, static_cast<int>(lround(sqrt(static_cast<double>(size)))));
+                buildGridCity(fds, side, 42);
+                prefix = "G";
+                nodes = side * side;
+            } else {
+                buildGeometricCity(fds, size, 42);
+                prefix = "P";
+                nodes = size;
+            }
+            fds.addLocation("Depot");
+            fds.addRoute("Depot", prefix + "0", 1);
+            string label = string(shape == 0 ? "grid/" : "geometric/") +
+                           (size >= 1000000 ? to_string(size / 1000000) + "m" : size >= 1000 ? to_string(size / 1000) + "k" : to_string(size));
+            printf("# %s: %d locations, built in %.0f ms\n", label.c_str(), nodes,
+                   chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count());
+
+            mt19937 rng(7);
+            vector<string> names(4096);
+            for (string& name : names) name = prefix + to_string(rng() % nodes);
+            fds.findShortestPath(names[0], names[1]);  // freezes the graph outside the timings
+
+            printBenchmarkResult(label + "/findShortestPath", runBenchmark(budgetSeconds, 3, names.size() / 2, [&](size_t i) {
+                fds.findShortestPath(names[2 * i], names[2 * i + 1]);
+            }));
+
+            const size_t orders = 4096;
+            vector<int> orderIds;
+            for (size_t i = 0; i < orders; ++i) {
+                orderIds.push_back(fds.placeOrder(names[i % 16], names[i], 10.0).order.id);
+            }
+            printBenchmarkResult(label + "/optimizeDeliveryRoute", runBenchmark(budgetSeconds, 16, orders, [&](size_t i) {
+                fds.optimizeDeliveryRoute(orderIds[i]);
+            }));
+            while (fds.processNextOrder().status == Status::Ok) {}
+
+            printBenchmarkResult(label + "/placeOrder+processNextOrder", runBenchmark(budgetSeconds, 1000, 1 << 20, [&](size_t i) {
+                fds.placeOrder(names[i % names.size()], names[(i + 1) % names.size()], 10.0);
+                fds.processNextOrder();
+            }));
+            printBenchmarkResult(label + "/revertLastDelivery", runBenchmark(budgetSeconds, 1000, 1 << 15, [&](size_t) {
+                fds.revertLastDelivery();
+            }));
+            fflush(stdout);
+        }
+    }
+}
+
+
+// Randomised cross-checks of the incrementally maintained structures against plain Dijkstra on
+// small networks, where the corner cases (ties, disconnected parts, tiny regions) are dense.
+// --self-test [rounds] runs them all; any mismatch makes it exit non-zero.
+struct SelfTestCount {
+    size_t checks = 0;
+    size_t mismatches = 0;
+};
+
+// Every pair's Overlay distance against Dijkstra after each route added between existing locations.
+SelfTestCount checkOverlayAfterNewRoutes(mt19937& rng, int rounds) {
+    SelfTestCount count;
+    for (int round = 0; round < rounds; ++round) {
+        FoodDeliverySystem fds;
+        int n = 4 + static_cast<int>(rng() % 12);
+        for (int i = 0; i < n; ++i) fds.addLocation("L" + to_string(i));
+        fds.setRegionSize(1 + rng() % 4);
+        set<pair<int, int>> routes;
+        for (int step = 0; step < 2 * n; ++step) {
+            int a = static_cast<int>(rng() % n), b = static_cast<int>(rng() % n);
+            if (a == b || !routes.insert(minmax(a, b)).second) continue;
+            fds.addRoute("L" + to_string(a), "L" + to_string(b), static_cast<int>(rng() % 10));
+            for (int from = 0; from < n; ++from) {
+                for (int to = 0; to < n; ++to) {
+                    fds.setSearchMode(SearchMode::Dijkstra);
+                    int expected = fds.shortestDistance("L" + to_string(from), "L" + to_string(to));
+                    fds.setSearchMode(SearchMode::Overlay);
+                    ++count.checks;
+                    count.mismatches += fds.shortestDistance("L" + to_string(from), "L" + to_string(to)) != expected;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Both legs of every order, served from repaired trees, against Dijkstra after addRoutes batches
+// that may change one route several times.
+SelfTestCount checkTreeRepairBatches(mt19937& rng, int rounds) {
+    SelfTestCount count;
+    for (int round = 0; round < rounds; ++round) {
+        FoodDeliverySystem fds;
+        fds.setRouteCacheBytes(0);
+        int n = 4 + static_cast<int>(rng() % 12);
+        auto name = [](int i) { return "L" + to_string(i); };
+        for (int i = 0; i < n; ++i) fds.addLocation(name(i));
+        for (int i = 1; i < n; ++i) fds.addRoute(name(i), name(static_cast<int>(rng() % i)), 1 + static_cast<int>(rng() % 9));
+        fds.addCourier(name(static_cast<int>(rng() % n)));
+        vector<Order> orders;
+        for (int i = 0; i < 6; ++i) {
+            orders.push_back(fds.placeOrder(name(static_cast<int>(rng() % 3)), name(static_cast<int>(rng() % n)), 10).order);
+        }
+        for (int batch = 0; batch < 8; ++batch) {
+            vector<Route> routes;
+            for (int i = 0; i < 6; ++i) {
+                // Few distinct pairs, so batches often repeat a route.
+                int a = static_cast<int>(rng() % min(n, 5)), b = static_cast<int>(rng() % n);
+                if (a != b) routes.push_back({name(a), name(b), static_cast<int>(rng() % 12)});
+            }
+            fds.addRoutes(routes);
+            for (const Order& order : orders) {
+                DeliveryRoute route = fds.optimizeDeliveryRoute(order.id);
+                string restaurant(fds.locationName(order.restaurant));
+                ++count.checks;
+                count.mismatches += route.deliveryDistance != fds.shortestDistance(restaurant, string(fds.locationName(order.destination)));
+                if (route.agentPath.empty()) continue;
+                ++count.checks;
+                count.mismatches += route.agentDistance != fds.shortestDistance(string(fds.locationName(route.agentPath.front())), restaurant);
+            }
+        }
+    }
+    return count;
+}
+
+int selfTest(int rounds) {
+    const pair<const char*, SelfTestCount (*)(mt19937&, int)> checks[] = {
+        {"overlay after new routes", checkOverlayAfterNewRoutes},
+        {"tree repair with repeated routes", checkTreeRepairBatches},
+    };
+    mt19937 rng(11);
+    int failed = 0;
+    for (const auto& check : checks) {
+        SelfTestCount count = check.second(rng, rounds);
+        printf("%-40s %10zu checks %8zu mismatches\n", check.first, count.checks, count.mismatches);
+        failed += count.mismatches != 0;
+    }
+    return failed ? 1 : 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    // In batch mode stdout carries only results: narration moves to stderr, and unsynced
+    // streams let runBatch see how much input is already buffered.
+    streambuf* standardOutput = cout.rdbuf();
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--batch") {
+            ios::sync_with_stdio(false);
+            standardOutput = cout.rdbuf(cerr.rdbuf());
+            break;
+        }
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-ch") {
+        benchmarkContractionHierarchy(argc > 2 ? atoi(argv[2]) : 100, argc > 3 ? atoi(argv[3]) : 1000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        // --bench [1k|100k|1m ...]; all three sizes by default.
+        vector<int> sizes;
+        for (int i = 2; i < argc; ++i) {
+            string size = argv[i];
+            int scale = 1;
+            if (!size.empty() && (size.back() == 'k' || size.back() == 'K')) scale = 1000;
+            if (!size.empty() && (size.back() == 'm' || size.back() == 'M')) scale = 1000000;
+            sizes.push_back(atoi(size.c_str()) * scale);
+        }
+        if (sizes.empty()) sizes = {1000, 100000, 1000000};
+        benchmarkSuite(sizes, 1.0);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-heaps") {
+        benchmarkFrontiers(argc > 2 ? atoi(argv[2]) : 20);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--self-test") {
+        return selfTest(argc > 2 ? atoi(argv[2]) : 200);
+    }
+
+    ofstream eventLogFile;  // declared first so it outlives the system's final flush
     FoodDeliverySystem fds;
     int choice;
 
+    // --load <snapshot> and --import-csv <edges.csv> populate the network before the menu starts;
+    // --save <snapshot> writes the result and exits, which turns a CSV export into a snapshot.
+    // --batch <file|-> runs headless commands instead of the menu; --log <file> records
+    // state changes as JSON lines; --metrics <file> gets a Prometheus text dump on exit.
+    // --scheduler fifo|priority picks the queue discipline; --journal <file> recovers orders from
+    // a write-ahead journal and keeps appending to it. --reorder auto|hilbert|rcm renumbers the
+    // locations loaded so far for locality; combined with --save the snapshot keeps that order.
+    string savePath, batchPath, metricsPath;
+    NodeOrder order;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            cout << "Error: " << option << " needs a file argument." << endl;
+            return 1;
+        }
+        if (option == "--load") {
+            if (!printNetworkFileResult(fds.loadNetwork(argv[i + 1]), "loaded", argv[i + 1])) return 1;
+        } else if (option == "--import-csv") {
+            printNetworkFileResult(fds.importRoutesCsv(argv[i + 1]), "import", argv[i + 1]);
+        } else if (option == "--reorder" && parseNodeOrder(argv[i + 1], order)) {
+            if (fds.reorderLocations(order) != Status::Ok) {
+                cout << "Error: Locations can only be reordered before any order is placed." << endl;
+                return 1;
+            }
+        } else if (option == "--log") {
+            eventLogFile.open(argv[i + 1], ios::app);
+            if (!eventLogFile) {
+                cout << "Error: Could not open " << argv[i + 1] << "." << endl;
+                return 1;
+            }
+            fds.setEventLog(&eventLogFile);
+        } else if (option == "--save") {
+            savePath = argv[i + 1];
+        } else if (option == "--batch") {
+            batchPath = argv[i + 1];
+        } else if (option == "--metrics") {
+            metricsPath = argv[i + 1];
+        } else if (option == "--journal") {
+            if (!printJournalResult(fds.openJournal(argv[i + 1]), argv[i + 1])) return 1;
+        } else if (option == "--scheduler" && (string(argv[i + 1]) == "fifo" || string(argv[i + 1]) == "priority")) {
+            SchedulerOptions options;
+            options.policy = string(argv[i + 1]) == "fifo" ? SchedulingPolicy::Fifo : SchedulingPolicy::Priority;
+            fds.setScheduler(options);
+        } else {
+            cout << "Error: Unknown option " << option << "." << endl;
+            return 1;
+        }
+    }
+    if (!savePath.empty()) return printNetworkFileResult(fds.saveNetwork(savePath), "saved", savePath) ? 0 : 1;
+    auto dumpMetrics = [&]() {
+        if (metricsPath.empty()) return;
+        ofstream metricsFile(metricsPath, ios::trunc);
+        writePrometheusMetrics(metricsFile, fds.metrics());
+    };
+    if (!batchPath.empty()) {
+        fds.addLocation("Depot");
+        ostream results(standardOutput);
+        if (batchPath == "-") {
+            runBatch(fds, cin, results);
+        } else {
+            ifstream commands(batchPath);
+            if (!commands) {
+                cout << "Error: Could not open " << batchPath << "." << endl;
+                return 1;
+            }
+            runBatch(fds, commands, results);
+        }
+        dumpMetrics();
+        if (fds.flushJournal() != Status::Ok) {
+            cout << "Error: Could not write the order journal." << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     cout << "--- Initial Setup ---" << endl;
     cout << "Setting up central Depot location..." << endl;
-    fds.addLocation("Depot");
+    printLocationAdded(fds.addLocation("Depot"), "Depot");
 
     do {
         showMenu();
@@ -356,7 +6703,7 @@ int main() {
             case 1: {
                 cout << "Enter new location name: ";
                 string locName = getStringInput();
-                fds.addLocation(locName);
+                printLocationAdded(fds.addLocation(locName), locName);
                 break;
             }
             case 2: {
@@ -368,7 +6715,10 @@ int main() {
                 end = getStringInput();
                 cout << "Enter distance (km): ";
                 dist = getIntInput();
-                fds.addRoute(start, end, dist);
+                Status status = fds.addRoute(start, end, dist);
+                if (status == Status::Ok) cout << "Route added: " << start << " <-> " << end << " (" << dist << " km)" << endl;
+                else if (status == Status::InvalidDistance) cout << "Error: Route distance cannot be negative." << endl;
+                else cout << "Error: One or both locations do not exist. Add them first." << endl;
                 break;
             }
             case 3: {
@@ -380,34 +6730,60 @@ int main() {
                 dest = getStringInput();
                 cout << "Enter Order Price ($): ";
                 price = getDoubleInput();
-                fds.placeOrder(rest, dest, price);
+                OrderResult result = fds.placeOrder(rest, dest, price);
+                if (result.status == Status::Ok) cout << "New Order Placed (ID: " << result.order.id << "): " << rest << " -> " << dest << endl;
+                else if (result.status == Status::QueueFull) cout << "Error: The pending order queue is full." << endl;
+                else if (result.status == Status::OrderIdsExhausted) cout << "Error: No order ids are left." << endl;
+                else cout << "Error: Restaurant or destination location does not exist in the map." << endl;
                 break;
             }
             case 4: {
-                fds.processNextOrder();
+                OrderResult result = fds.processNextOrder();
+                if (result.status != Status::Ok) {
+                    cout << "No pending orders in the queue." << endl;
+                    break;
+                }
+                cout << "Processing Order ID " << result.order.id << "..." << endl;
+                cout << "Order ID " << result.order.id << " delivered successfully!" << endl;
                 break;
             }
             case 5: {
-                fds.trackLastDelivery();
+                OrderResult result = fds.lastDelivery();
+                if (result.status != Status::Ok) cout << "No deliveries completed yet." << endl;
+                else cout << "Last Completed Delivery (ID: " << result.order.id << "): " << fds.locationName(result.order.restaurant) << " to " << fds.locationName(result.order.destination) << endl;
                 break;
             }
             case 6: {
-                fds.listPendingOrders();
+                printPendingOrders(fds);
                 break;
             }
             case 7: {
                 int orderId;
                 cout << "Enter Order ID to optimize route for: ";
                 orderId = getIntInput();
-                fds.optimizeDeliveryRoute(orderId);
+                printDeliveryRoute(fds, fds.optimizeDeliveryRoute(orderId));
                 break;
             }
             case 8: {
-                fds.revertLastDelivery();
+                OrderResult result = fds.revertLastDelivery();
+                if (result.status == Status::Ok) cout << "Reverted delivery ID " << result.order.id << " and placed back in the pending queue." << endl;
+                else if (result.status == Status::QueueFull) cout << "Error: The pending order queue is full." << endl;
+                else cout << "No completed deliveries to revert." << endl;
                 break;
             }
             case 9: {
-                fds.systemStatus();
+                printSystemStatus(fds);
+                break;
+            }
+            case 10: {
+                vector<DeliveryRoute> routes = fds.optimizePendingRoutes();
+                if (routes.empty()) {
+                    cout << "The order queue is empty." << endl;
+                } else if (routes[0].status == Status::DepotMissing) {
+                    printDeliveryRoute(fds, routes[0]);
+                } else {
+                    for (const DeliveryRoute& route : routes) printDeliveryRoute(fds, route);
+                }
                 break;
             }
             case 0: {
@@ -421,6 +6797,7 @@ int main() {
         }
     } while (choice != 0);
 
+    dumpMetrics();
     return 0;
 
 }